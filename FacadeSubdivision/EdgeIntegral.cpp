@@ -0,0 +1,116 @@
+#include "EdgeIntegral.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace fs {
+
+	namespace {
+		int popcount(uint64 x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+			return (int)__popcnt64(x);
+#elif defined(__GNUC__)
+			return __builtin_popcountll(x);
+#else
+			x = x - ((x >> 1) & 0x5555555555555555ULL);
+			x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+			x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+			return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+		}
+
+		/**
+		 * Return the number of bits in [0, n) of the packed line.
+		 */
+		int countBefore(const uint64* bits, const int* prefix, int n) {
+			int count = prefix[n >> 6];
+			if (n & 63) {
+				count += popcount(bits[n >> 6] & ((1ULL << (n & 63)) - 1));
+			}
+			return count;
+		}
+
+		void buildPrefix(const uint64* bits, int num_words, int* prefix) {
+			prefix[0] = 0;
+			for (int i = 0; i < num_words; ++i) {
+				prefix[i + 1] = prefix[i] + popcount(bits[i]);
+			}
+		}
+	}
+
+	EdgeIntegral::EdgeIntegral() : rows(0), cols(0), row_words(0), col_words(0) {
+	}
+
+	/**
+	 * Pack the edge image and build the prefix tables.
+	 *
+	 * @param edge_img		edge image (1-channel 8-bit image, non-zero pixels are edges)
+	 */
+	EdgeIntegral::EdgeIntegral(const cv::Mat& edge_img) : rows(edge_img.rows), cols(edge_img.cols) {
+		CV_Assert(edge_img.type() == CV_8U);
+
+		row_words = (cols + 63) / 64;
+		col_words = (rows + 63) / 64;
+		row_bits.assign(rows * row_words, 0);
+		col_bits.assign(cols * col_words, 0);
+		for (int r = 0; r < rows; ++r) {
+			const unsigned char* p = edge_img.ptr<unsigned char>(r);
+			uint64* row = &row_bits[r * row_words];
+			for (int c = 0; c < cols; ++c) {
+				if (p[c] == 0) continue;
+
+				row[c >> 6] |= 1ULL << (c & 63);
+				col_bits[c * col_words + (r >> 6)] |= 1ULL << (r & 63);
+			}
+		}
+
+		row_prefix.resize(rows * (row_words + 1));
+		for (int r = 0; r < rows; ++r) {
+			buildPrefix(&row_bits[r * row_words], row_words, &row_prefix[r * (row_words + 1)]);
+		}
+		col_prefix.resize(cols * (col_words + 1));
+		for (int c = 0; c < cols; ++c) {
+			buildPrefix(&col_bits[c * col_words], col_words, &col_prefix[c * (col_words + 1)]);
+		}
+	}
+
+	/**
+	 * Return the number of edges of the row r in the columns [c1, c2).
+	 */
+	int EdgeIntegral::countRow(int r, int c1, int c2) const {
+		const uint64* bits = row_words > 0 ? &row_bits[r * row_words] : NULL;
+		const int* prefix = &row_prefix[r * (row_words + 1)];
+		return countBefore(bits, prefix, c2) - countBefore(bits, prefix, c1);
+	}
+
+	/**
+	 * Return the number of edges of the column c in the rows [r1, r2).
+	 */
+	int EdgeIntegral::countCol(int c, int r1, int r2) const {
+		const uint64* bits = col_words > 0 ? &col_bits[c * col_words] : NULL;
+		const int* prefix = &col_prefix[c * (col_words + 1)];
+		return countBefore(bits, prefix, r2) - countBefore(bits, prefix, r1);
+	}
+
+	/**
+	 * Compute the sums of the edge image (0/255) in each row and each column of the tile,
+	 * which are the same as cv::reduce(edges, ..., cv::REDUCE_SUM, CV_32F) of the tile.
+	 *
+	 * @param rect		tile
+	 * @param edgeV		[OUT] sum of each row (rect.height x 1)
+	 * @param edgeH		[OUT] sum of each column (1 x rect.width)
+	 */
+	void EdgeIntegral::project(const cv::Rect& rect, cv::Mat_<float>& edgeV, cv::Mat_<float>& edgeH) const {
+		edgeV.create(rect.height, 1);
+		for (int r = 0; r < rect.height; ++r) {
+			edgeV(r, 0) = 255.0f * countRow(rect.y + r, rect.x, rect.x + rect.width);
+		}
+
+		edgeH.create(1, rect.width);
+		for (int c = 0; c < rect.width; ++c) {
+			edgeH(0, c) = 255.0f * countCol(rect.x + c, rect.y, rect.y + rect.height);
+		}
+	}
+
+}
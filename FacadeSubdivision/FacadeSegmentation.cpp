@@ -1,11 +1,16 @@
 ﻿#include "FacadeSegmentation.h"
 #include "CVUtils.h"
 #include "Utils.h"
+#include "GradientIntegral.h"
+#include "EdgeIntegral.h"
+#include "TileClassifier.h"
 #include <fstream>
+#include <algorithm>
+#include <limits>
 
 namespace fs {
 
-	void subdivideFacade(const cv::Mat& img, int num_floors, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects) {
+	void subdivideFacade(const cv::Mat& img, int num_floors, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects, bool skip_blank_tiles, TileStats* stats, const RefinementOptions& refinement) {
 		// compute the average floor height
 		float avg_floor_height = img.rows / num_floors;
 
@@ -32,12 +37,16 @@ namespace fs {
 			cv::blur(Hor, Hor, cv::Size(kernel_size, kernel_size));
 		}
 
+		// the minima of Ver/Hor are found once and queried for each threshold
+		MinimaHierarchy Ver_hierarchy(Ver);
+		MinimaHierarchy Hor_hierarchy(Hor);
+
 		float min_diff = std::numeric_limits<float>::max();
 		float min_thr;
 		for (float thr = 0.3; thr > 0.05; thr -= 0.05) {
 			// Facadeのsplit linesを求める
 			std::vector<float> y_split_candidate;
-			getSplitLines(Ver, thr, y_split_candidate);
+			getSplitLines(Ver_hierarchy, thr, y_split_candidate);
 			refineSplitLines(y_split_candidate, avg_floor_height, 0.45);
 
 			float diff = 0;
@@ -54,7 +63,7 @@ namespace fs {
 		}
 		//std::cout << "thresh: " << min_thr << std::endl;
 
-		getSplitLines(Hor, min_thr, x_split);
+		getSplitLines(Hor_hierarchy, min_thr, x_split);
 		refineSplitLines(x_split, 0.2);
 
 		// convert to grayscale
@@ -68,14 +77,19 @@ namespace fs {
 
 		// facadeの端のエッジを削除する
 		int margin = 10;
-		for (int r = 0; r < edge_img.rows; ++r) {
-			for (int c = 0; c < edge_img.cols; ++c) {
-				if (r < margin || r >= edge_img.rows - margin || c < margin || c >= edge_img.cols - margin) {
-					edge_img.at<unsigned char>(r, c) = 0;
-
-				}
-			}
+		cv::Mat border_mask(edge_img.size(), CV_8U, cv::Scalar(255));
+		if (edge_img.rows > margin * 2 && edge_img.cols > margin * 2) {
+			border_mask(cv::Rect(margin, margin, edge_img.cols - margin * 2, edge_img.rows - margin * 2)).setTo(0);
 		}
+		edge_img.setTo(0, border_mask);
+
+		// 各tileのedgeの和を求めるための、bit-packed edge map
+		EdgeIntegral edge_integral(edge_img);
+
+		// 壁しかないtileは、skip_blank_tilesの場合、窓の検出をスキップする
+		// (statsが与えられた場合は、スキップするtileでも検出を行い、窓が見つかったtileを誤ったスキップとして数える)
+		TileClassifier classifier;
+		if (skip_blank_tiles || stats != NULL) classifier = TileClassifier(gray_img);
 
 		// 各tileの窓の位置を求める
 		int window_count = 0;
@@ -83,10 +97,33 @@ namespace fs {
 		for (int i = 0; i < y_split.size() - 1; ++i) {
 			win_rects[i].resize(x_split.size() - 1);
 			for (int j = 0; j < x_split.size() - 1; ++j) {
-				cv::Mat tile(gray_img, cv::Rect(x_split[j], y_split[i], x_split[j + 1] - x_split[j], y_split[i + 1] - y_split[i]));
-				cv::Mat tile_edges(edge_img, cv::Rect(x_split[j], y_split[i], x_split[j + 1] - x_split[j], y_split[i + 1] - y_split[i]));
+				cv::Rect rect(x_split[j], y_split[i], x_split[j + 1] - x_split[j], y_split[i + 1] - y_split[i]);
+				cv::Mat tile(gray_img, rect);
+
+				bool blank = !classifier.empty() && classifier.isBlank(rect);
+				if (stats != NULL) {
+					stats->num_tiles++;
+					if (blank) stats->num_skipped++;
+					if (!blank || !skip_blank_tiles) stats->num_detections++;
+				}
+				if (blank && skip_blank_tiles && stats == NULL) {
+					win_rects[i][j] = WindowPos();
+					win_rects[i][j].valid = WindowPos::UNCERTAIN;
+					continue;
+				}
+
+				bool found = subdivideTile(tile, edge_integral, rect, 1, 1, win_rects[i][j]);
+				if (blank) {
+					if (found && stats != NULL) stats->num_false_skips++;
 
-				if (subdivideTile(tile, tile_edges, 1, 1, win_rects[i][j])) {
+					// スキップしたtileは、窓が見つかっても検出しなかった場合と同じ結果とする
+					if (skip_blank_tiles) {
+						win_rects[i][j] = WindowPos();
+						win_rects[i][j].valid = WindowPos::UNCERTAIN;
+						found = false;
+					}
+				}
+				if (found) {
 					window_count++;
 				}
 
@@ -99,6 +136,11 @@ namespace fs {
 			//refine(y_split, x_split, win_rects, 0.3);
 			align(edge_img, y_split, x_split, win_rects, 20);
 		}
+
+		// 窓の辺をedgeに合わせる
+		if (refinement.enabled) {
+			refineWindows(edge_integral, y_split, x_split, win_rects, refinement.max_iter, refinement.lambda, refinement.radius);
+		}
 	}
 
 	/**
@@ -313,15 +355,29 @@ namespace fs {
 		Ver = cv::Mat_<float>(grayImg.rows, 1, 0.0f);
 		Hor = cv::Mat_<float>(1, grayImg.cols, 0.0f);
 		float beta = 0.1f;
+
+		// The profiles are convolved with the cached Gaussian kernel truncated at 6 sigma,
+		// where the weight relative to the center is below the float precision (exp(-18)).
+		// The terms outside the image are not added as before, so the boundary handling is the same.
+		utils::GaussianKernel kernel(sigma);
+		std::vector<float> ver_profile(grayImg.rows);
+		for (int rr = 0; rr < grayImg.rows; ++rr) {
+			ver_profile[rr] = ver_xtotal.at<float>(rr, 0) - beta * hor_xtotal.at<float>(rr, 0);
+		}
+		std::vector<float> ver_smoothed;
+		kernel.convolve(ver_profile, ver_smoothed);
 		for (int r = 0; r < grayImg.rows; ++r) {
-			for (int rr = 0; rr < grayImg.rows; ++rr) {
-				Ver(r, 0) += (ver_xtotal.at<float>(rr, 0) - beta * hor_xtotal.at<float>(rr, 0)) * utils::gause(rr - r, sigma);
-			}
+			Ver(r, 0) = ver_smoothed[r];
 		}
+
+		std::vector<float> hor_profile(grayImg.cols);
+		for (int cc = 0; cc < grayImg.cols; ++cc) {
+			hor_profile[cc] = hor_ytotal.at<float>(0, cc) - beta * ver_ytotal.at<float>(0, cc);
+		}
+		std::vector<float> hor_smoothed;
+		kernel.convolve(hor_profile, hor_smoothed);
 		for (int c = 0; c < grayImg.cols; ++c) {
-			for (int cc = 0; cc < grayImg.cols; ++cc) {
-				Hor(0, c) += (hor_ytotal.at<float>(0, cc) - beta * ver_ytotal.at<float>(0, cc)) * utils::gause(cc - c, sigma);
-			}
+			Hor(0, c) = hor_smoothed[c];
 		}
 	}
 
@@ -348,6 +404,20 @@ namespace fs {
 		cv::reduce(sobelx, Ver, 1, CV_REDUCE_SUM);
 	}
 
+	/**
+	* Facade全体のGradientIntegralから、tileのVer(y)とHor(x)を計算する。
+	* subdivideTile2に渡すVer、Horと同じ形 (Ver: h x 1、Hor: 1 x w) で、O(h + w)で求まる。
+	*
+	* @param grad		gradient integral of the facade
+	* @param rect		tile
+	* @param Ver		Ver(y)
+	* @param Hor		Hor(x)
+	*/
+	void computeVerAndHor2(const GradientIntegral& grad, const cv::Rect& rect, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor) {
+		cv::Mat_<float> sobelx_hor, sobely_ver;
+		grad.sum(rect, Ver, sobelx_hor, sobely_ver, Hor);
+	}
+
 	/**
 	 * tile内のwindowを検出し、その矩形座標を返却する。
 	 * windowが検出されなかった場合はfalseを返却する。
@@ -359,16 +429,30 @@ namespace fs {
 	 * @return						分割する場合はtrue / false otherwise
 	 */
 	bool subdivideTile(const cv::Mat& tile, const cv::Mat& edges, int min_size, int tile_margin, WindowPos& winpos) {
+		return subdivideTile(tile, EdgeIntegral(edges), cv::Rect(0, 0, edges.cols, edges.rows), min_size, tile_margin, winpos);
+	}
+
+	/**
+	* Facade全体のbit-packed edge mapを使って、tileの窓の位置を求める。
+	*
+	* @param tile			tile image
+	* @param edges			edges of the whole facade
+	* @param rect			tile in the facade
+	* @param min_size		minimum size of the tile
+	* @param tile_margin	margin of the tile
+	* @param winpos		[OUT] window position
+	* @return				true if a window is found
+	*/
+	bool subdivideTile(const cv::Mat& tile, const EdgeIntegral& edges, const cv::Rect& rect, int min_size, int tile_margin, WindowPos& winpos) {
 		if (tile.cols < min_size || tile.rows < min_size) {
 			winpos.valid = WindowPos::INVALID;
 			return false;
 		}
 
 		// sum horizontally and vertically
-		cv::Mat vertical_edges;
-		cv::Mat horizontal_edges;
-		cv::reduce(edges, vertical_edges, 0, CV_REDUCE_SUM, CV_32F);
-		cv::reduce(edges, horizontal_edges, 1, CV_REDUCE_SUM, CV_32F);
+		cv::Mat_<float> vertical_edges;
+		cv::Mat_<float> horizontal_edges;
+		edges.project(rect, horizontal_edges, vertical_edges);
 
 		cv::Mat vertical_edges_max;
 		cv::Mat horizonta_edges_max;
@@ -598,81 +682,9 @@ namespace fs {
 	* @param y_split		最適なsplit lineの組み合わせ
 	*/
 	void findBestHorizontalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Ver, float min_interval, float max_interval, std::vector<int>& y_split) {
-		y_split.clear();
-
-		std::vector<int> y_candidates = cvutils::getPeak(Ver, false, 1, cvutils::LOCAL_MINIMUM, 1);
-		y_candidates.insert(y_candidates.begin(), 0);
-		y_candidates.push_back(img.rows - 1);
-
-		std::vector<std::vector<float>> costs;
-		std::vector<std::vector<int>> indices;
-		std::vector<std::vector<int>> nums;
-
-		// 最初の行のコストを初期化
-		{
-			costs.push_back(std::vector<float>(y_candidates.size(), std::numeric_limits<float>::max()));
-			indices.push_back(std::vector<int>(y_candidates.size(), -1));
-			nums.push_back(std::vector<int>(y_candidates.size(), 0));
-			costs[0][0] = 0;
-			indices[0][0] = 0;
-			nums[0][0] = 0;
-		}
-
-		// 2行目以降について、Dynamic Programmingで最小コストを計算
-		for (int i = 1;; ++i) {
-			costs.push_back(std::vector<float>(y_candidates.size(), std::numeric_limits<float>::max()));
-			indices.push_back(std::vector<int>(y_candidates.size(), -1));
-			nums.push_back(std::vector<int>(y_candidates.size(), 0));
-
-			for (int k = 0; k < y_candidates.size() - 1; ++k) {
-				bool found = false;
-
-				for (int j = k + 1; j < y_candidates.size() - 1; ++j) {
-					if (indices[i - 1][k] == -1) continue;
-
-					if (y_candidates[j] - y_candidates[k] < min_interval) continue;
-					if (found && y_candidates[j] - y_candidates[k] > max_interval) continue;
-
-					found = true;
-					float new_cost = costs[i - 1][k] + Ver(y_candidates[j], 0);
-					if (new_cost / (nums[i - 1][k] + 1) < costs[i][j] / nums[i][j]) {
-						costs[i][j] = new_cost;
-						indices[i][j] = k;
-						nums[i][j] = nums[i - 1][k] + 1;
-					}
-				}
-			}
-
-			for (int k = 0; k < y_candidates.size(); ++k) {
-				if (indices[i - 1][k] == -1) continue;
-
-				if (y_candidates.back() - y_candidates[k] > max_interval) continue;
-
-				if (costs[i - 1][k] / nums[i - 1][k] < costs[i].back() / nums[i].back()) {
-					costs[i].back() = costs[i - 1][k];
-					indices[i].back() = k;
-					nums[i].back() = nums[i - 1][k];
-				}
-			}
-
-			// 最後のy以外がすべて-1なら、終了
-			bool updated = false;
-			for (int j = 0; j < indices[i].size() - 1; ++j) {
-				if (indices[i][j] != -1) updated = true;
-			}
-			if (!updated) break;
-		}
-
-		// y_splitに、最適解を格納する
-		y_split.push_back(y_candidates.back());
-		int prev_index = y_candidates.size() - 1;
-		for (int i = indices.size() - 1; i >= 1; --i) {
-			int index = indices[i][prev_index];
-			if (index == prev_index) continue;
-
-			y_split.insert(y_split.begin(), y_candidates[index]);
-			prev_index = index;
-		}
+		std::vector<SplitConfiguration> configs;
+		findKBestHorizontalSplitLines(img, Ver, min_interval, max_interval, 1, configs);
+		y_split = configs[0].positions;
 	}
 
 	/**
@@ -684,80 +696,165 @@ namespace fs {
 	* @param x_split		最適なsplit lineの組み合わせ
 	*/
 	void findBestVerticalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Hor, float min_interval, float max_interval, std::vector<int>& x_split) {
-		x_split.clear();
+		std::vector<SplitConfiguration> configs;
+		findKBestVerticalSplitLines(img, Hor, min_interval, max_interval, 1, configs);
+		x_split = configs[0].positions;
+	}
 
+	/**
+	* 上位K個の水平方向のsplit linesを、コスト (split lineにおけるVerの平均値) の昇順に返す。
+	*
+	* @param img				image
+	* @param Ver				Ver(y)
+	* @param min_interval		minimum interval between split lines
+	* @param max_interval		maximum interval between split lines
+	* @param K					number of configurations
+	* @param configs			[OUT] at most K configurations (the both ends are included in the split lines)
+	*/
+	void findKBestHorizontalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Ver, float min_interval, float max_interval, int K, std::vector<SplitConfiguration>& configs) {
+		std::vector<int> y_candidates = cvutils::getPeak(Ver, false, 1, cvutils::LOCAL_MINIMUM, 1);
+		y_candidates.insert(y_candidates.begin(), 0);
+		y_candidates.push_back(img.rows - 1);
+
+		findKBestSplitLines(y_candidates, Ver, min_interval, max_interval, K, configs);
+	}
+
+	/**
+	* 上位K個の垂直方向のsplit linesを、コスト (split lineにおけるHorの平均値) の昇順に返す。
+	*
+	* @param img				image
+	* @param Hor				Hor(x)
+	* @param min_interval		minimum interval between split lines
+	* @param max_interval		maximum interval between split lines
+	* @param K					number of configurations
+	* @param configs			[OUT] at most K configurations (the both ends are included in the split lines)
+	*/
+	void findKBestVerticalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Hor, float min_interval, float max_interval, int K, std::vector<SplitConfiguration>& configs) {
 		std::vector<int> x_candidates = cvutils::getPeak(Hor, false, 1, cvutils::LOCAL_MINIMUM, 1);
 		x_candidates.insert(x_candidates.begin(), 0);
 		x_candidates.push_back(img.cols - 1);
 
-		std::vector<std::vector<float>> costs;
-		std::vector<std::vector<int>> indices;
-		std::vector<std::vector<int>> nums;
-
-		// 最初の列のコストを初期化
-		{
-			costs.push_back(std::vector<float>(x_candidates.size(), std::numeric_limits<float>::max()));
-			indices.push_back(std::vector<int>(x_candidates.size(), -1));
-			nums.push_back(std::vector<int>(x_candidates.size(), 0));
-			costs[0][0] = 0;
-			indices[0][0] = 0;
-			nums[0][0] = 0;
-		}
-
-		// 2列目以降について、Dynamic Programmingで最小コストを計算
-		for (int i = 1;; ++i) {
-			costs.push_back(std::vector<float>(x_candidates.size(), std::numeric_limits<float>::max()));
-			indices.push_back(std::vector<int>(x_candidates.size(), -1));
-			nums.push_back(std::vector<int>(x_candidates.size(), 0));
-
-			for (int k = 0; k < x_candidates.size() - 1; ++k) {
-				bool found = false;
-
-				for (int j = k + 1; j < x_candidates.size() - 1; ++j) {
-					if (indices[i - 1][k] == -1) continue;
-
-					if (x_candidates[j] - x_candidates[k] < min_interval) continue;
-					if (found && x_candidates[j] - x_candidates[k] > max_interval) continue;
-
-					found = true;
-					float new_cost = costs[i - 1][k] + Hor(0, x_candidates[j]);
-					if (new_cost / (nums[i - 1][k] + 1) < costs[i][j] / nums[i][j]) {
-						costs[i][j] = new_cost;
-						indices[i][j] = k;
-						nums[i][j] = nums[i - 1][k] + 1;
+		findKBestSplitLines(x_candidates, Hor, min_interval, max_interval, K, configs);
+	}
+
+	/**
+	* 候補の中から、split lineにおけるprofileの平均値が小さい上位K個のsplit linesをDynamic Programmingで求める。
+	* i番目のstageはsplit lineがi本のpathを表し、各 (stage, 候補) について上位K個のコストと戻り先を
+	* 1つのflatなtableに保持するので、1回のDPと上位K個のbacktrackで全ての解が得られる。
+	*
+	* @param candidates		candidates of split lines (the first and the last ones are the both ends)
+	* @param profile			Ver(y) or Hor(x)
+	* @param min_interval		minimum interval between split lines
+	* @param max_interval		maximum interval between split lines
+	* @param K					number of configurations
+	* @param configs			[OUT] at most K configurations in ascending order of the cost
+	*/
+	void findKBestSplitLines(const std::vector<int>& candidates, const cv::Mat_<float>& profile, float min_interval, float max_interval, int K, std::vector<SplitConfiguration>& configs) {
+		configs.clear();
+
+		int n = candidates.size();
+		int num_stages = std::max(1, n - 1);
+
+		// the next candidates of each candidate
+		// (the first one beyond min_interval is always connected, so that a long interval can be bridged)
+		std::vector<int> edge_begin(n);
+		std::vector<int> edges;
+		for (int k = 0; k < n - 1; ++k) {
+			edge_begin[k] = edges.size();
+			bool found = false;
+			for (int j = k + 1; j < n - 1; ++j) {
+				if (candidates[j] - candidates[k] < min_interval) continue;
+				if (found && candidates[j] - candidates[k] > max_interval) continue;
+
+				found = true;
+				edges.push_back(j);
+			}
+		}
+		edge_begin[n - 1] = edges.size();
+
+		// K-best table of (stage, candidate): cost in ascending order, and the previous (candidate, rank)
+		std::vector<float> costs(num_stages * n * K);
+		std::vector<int> prev_indices(num_stages * n * K);
+		std::vector<int> prev_ranks(num_stages * n * K);
+		std::vector<int> nums(num_stages * n, 0);
+		costs[0] = 0;
+		prev_indices[0] = -1;
+		prev_ranks[0] = -1;
+		nums[0] = 1;
+
+		int last_stage = 0;
+		for (int i = 1; i < num_stages; ++i) {
+			bool updated = false;
+			for (int k = 0; k < n - 1; ++k) {
+				int src = (i - 1) * n + k;
+				for (int r = 0; r < nums[src]; ++r) {
+					for (int e = edge_begin[k]; e < edge_begin[k + 1]; ++e) {
+						int dst = i * n + edges[e];
+						float new_cost = costs[src * K + r] + profile(candidates[edges[e]]);
+
+						// insert into the K-best list of the destination (after the ones of the same cost)
+						if (nums[dst] == K && new_cost >= costs[dst * K + K - 1]) continue;
+						int pos = std::min(nums[dst], K - 1);
+						for (; pos > 0 && costs[dst * K + pos - 1] > new_cost; --pos) {
+							costs[dst * K + pos] = costs[dst * K + pos - 1];
+							prev_indices[dst * K + pos] = prev_indices[dst * K + pos - 1];
+							prev_ranks[dst * K + pos] = prev_ranks[dst * K + pos - 1];
+						}
+						costs[dst * K + pos] = new_cost;
+						prev_indices[dst * K + pos] = k;
+						prev_ranks[dst * K + pos] = r;
+						nums[dst] = std::min(nums[dst] + 1, K);
+						updated = true;
 					}
 				}
 			}
 
-			for (int k = 0; k < x_candidates.size(); ++k) {
-				if (indices[i - 1][k] == -1) continue;
+			// 最後以外のsplit lineが1つも更新されなければ、終了
+			if (!updated) break;
+			last_stage = i;
+		}
 
-				if (x_candidates.back() - x_candidates[k] > max_interval) continue;
+		// the paths that can be closed with the last candidate, ranked by the average cost
+		std::vector<std::pair<float, cv::Vec3i>> ends;
+		for (int i = 1; i <= last_stage; ++i) {
+			for (int k = 1; k < n - 1; ++k) {
+				if (candidates.back() - candidates[k] > max_interval) continue;
 
-				if (costs[i - 1][k] / nums[i - 1][k] < costs[i].back() / nums[i].back()) {
-					costs[i].back() = costs[i - 1][k];
-					indices[i].back() = k;
-					nums[i].back() = nums[i - 1][k];
+				for (int r = 0; r < nums[i * n + k]; ++r) {
+					ends.push_back(std::make_pair(costs[(i * n + k) * K + r] / i, cv::Vec3i(i, k, r)));
 				}
 			}
-
-			// 最後のx以外がすべて-1なら、終了
-			bool updated = false;
-			for (int j = 0; j < indices[i].size() - 1; ++j) {
-				if (indices[i][j] != -1) updated = true;
-			}
-			if (!updated) break;
 		}
-
-		// x_splitに、最適解を格納する
-		x_split.push_back(x_candidates.back());
-		int prev_index = x_candidates.size() - 1;
-		for (int i = indices.size() - 1; i >= 1; --i) {
-			int index = indices[i][prev_index];
-			if (index == prev_index) continue;
-
-			x_split.insert(x_split.begin(), x_candidates[index]);
-			prev_index = index;
+		int num_configs = std::min((int)ends.size(), K);
+		std::partial_sort(ends.begin(), ends.begin() + num_configs, ends.end(), [](const std::pair<float, cv::Vec3i>& a, const std::pair<float, cv::Vec3i>& b) {
+			// on a tie, prefer more split lines, and then the earlier ones
+			if (a.first != b.first) return a.first < b.first;
+			if (a.second[0] != b.second[0]) return a.second[0] > b.second[0];
+			if (a.second[1] != b.second[1]) return a.second[1] < b.second[1];
+			return a.second[2] < b.second[2];
+		});
+
+		// backtrack
+		configs.resize(num_configs);
+		for (int c = 0; c < num_configs; ++c) {
+			configs[c].cost = ends[c].first;
+			configs[c].positions.push_back(candidates.back());
+			int k = ends[c].second[1];
+			int r = ends[c].second[2];
+			for (int i = ends[c].second[0]; i >= 0; --i) {
+				configs[c].positions.push_back(candidates[k]);
+				int index = (i * n + k) * K + r;
+				k = prev_indices[index];
+				r = prev_ranks[index];
+			}
+			std::reverse(configs[c].positions.begin(), configs[c].positions.end());
+		}
+
+		// if no path reaches the last candidate, only the both ends are returned
+		if (configs.empty()) {
+			configs.resize(1);
+			configs[0].positions.push_back(candidates.front());
+			configs[0].positions.push_back(candidates.back());
 		}
 	}
 
@@ -765,22 +862,27 @@ namespace fs {
 	* 与えられた関数の極小値を使ってsplit lineを決定する。
 	*/
 	void getSplitLines(const cv::Mat_<float>& val, float threshold, std::vector<float>& split_positions) {
-		split_positions.clear();
-
-		cv::Mat_<float> mat = val.clone();
-		if (mat.rows == 1) {
-			mat = mat.t();
-		}
+		getSplitLines(MinimaHierarchy(val), threshold, split_positions);
+	}
 
-		double max_value, min_value;
-		cv::minMaxLoc(mat, &min_value, &max_value);
-		threshold *= (max_value - min_value);
+	/**
+	 * Find the split lines from the minima hierarchy of the profile.
+	 * Building the hierarchy once and querying it for each threshold avoids rescanning the profile.
+	 *
+	 * @param hierarchy			minima hierarchy of the profile
+	 * @param threshold			threshold of the prominence relative to the range of the profile
+	 * @param split_positions	[OUT] split lines
+	 */
+	void getSplitLines(const MinimaHierarchy& hierarchy, float threshold, std::vector<float>& split_positions) {
+		split_positions.clear();
 
-		for (int r = 0; r < mat.rows; ++r) {
-			if (isLocalMinimum(mat, r, threshold)) {
-				split_positions.push_back(r);
-			}
+		// minima whose prominence exceeds the threshold
+		std::vector<int> minima;
+		hierarchy.minimaAbove(threshold, minima);
+		for (int i = 0; i < minima.size(); ++i) {
+			split_positions.push_back(minima[i]);
 		}
+		int length = hierarchy.numSamples();
 
 		// 両端処理
 		if (split_positions.size() == 0) {
@@ -795,12 +897,12 @@ namespace fs {
 			}
 		}
 
-		if (split_positions.back() < mat.rows) {
-			if (split_positions.back() >= mat.rows - 5) {
-				split_positions.back() = mat.rows;
+		if (split_positions.back() < length) {
+			if (split_positions.back() >= length - 5) {
+				split_positions.back() = length;
 			}
 			else {
-				split_positions.push_back(mat.rows);
+				split_positions.push_back(length);
 			}
 		}
 	}
@@ -871,64 +973,65 @@ namespace fs {
 	 * 分割線の一部を削除し、分割線の間隔が等間隔に近くなるようにする。
 	 */
 	void distributeSplitLines(std::vector<float>& split_positions, float threshold) {
-		std::vector<int> flags(split_positions.size() - 2, 0);
+		int n = split_positions.size();
+		if (n <= 2) return;
+
+		// The first and the last lines are always kept, and the sum of the intervals is fixed.
+		// Thus, for a fixed number of intervals, the stddev of intervals is minimized by minimizing the sum of squared intervals,
+		// which is solved by dynamic programming over (#intervals, last kept line).
+		// sq_sum[m * n + j]: the minimum sum of squared intervals from the first line to the j-th line with m intervals
+		std::vector<double> sq_sum(n * n, std::numeric_limits<double>::infinity());
+		std::vector<int> prev(n * n, -1);
+		sq_sum[0] = 0;
+		for (int m = 1; m < n; ++m) {
+			for (int j = m; j < n; ++j) {
+				for (int i = m - 1; i < j; ++i) {
+					if (sq_sum[(m - 1) * n + i] == std::numeric_limits<double>::infinity()) continue;
+
+					double d = split_positions[j] - split_positions[i];
+					double s = sq_sum[(m - 1) * n + i] + d * d;
+					if (s < sq_sum[m * n + j]) {
+						sq_sum[m * n + j] = s;
+						prev[m * n + j] = i;
+					}
+				}
+			}
+		}
 
 		float min_stddev = std::numeric_limits<float>::max();
-		std::vector<int> min_flags;
+		std::vector<int> min_lines;
+		for (int m = 1; m < n; ++m) {
+			// valid only if the kept lines are more than the threshold
+			if ((float)(m + 1) / split_positions.size() <= threshold) continue;
 
-		while (true) {
-			// count 1s
-			int cnt_ones = 0;
-			for (int i = 0; i < flags.size(); ++i) {
-				if (flags[i] == 1) cnt_ones++;
-			}
-
-			// valid only if 1s are more than 50%
-			if ((float)(cnt_ones + 2) / split_positions.size() > threshold) {
-				// compute the distances between split lines
-				std::vector<float> intervals;
-				float prev_pos = split_positions[0];
-				for (int i = 1; i < split_positions.size(); ++i) {
-					if (i < split_positions.size() - 1 && flags[i - 1] == 0) continue;
-
-					intervals.push_back(split_positions[i] - prev_pos);
-					prev_pos = split_positions[i];
-				}
-
-				// compute the stddev of intervals
-				float stddev = utils::stddev(intervals);
+			// the lines of the best subset with m intervals
+			std::vector<int> lines;
+			for (int j = n - 1, k = m; j >= 0; j = prev[k * n + j], --k) {
+				lines.push_back(j);
+			}
+			std::reverse(lines.begin(), lines.end());
 
-				// update the minimum stddev
-				if (stddev < min_stddev) {
-					min_stddev = stddev;
-					min_flags = flags;
-				}
+			// compute the stddev of intervals
+			std::vector<float> intervals;
+			for (int i = 0; i < (int)lines.size() - 1; ++i) {
+				intervals.push_back(split_positions[lines[i + 1]] - split_positions[lines[i]]);
 			}
+			float stddev = utils::stddev(intervals);
 
-			// next permutation
-			bool carried = false;
-			for (int i = 0; i < flags.size(); ++i) {
-				if (flags[i] == 1) {
-					flags[i] = 0;
-				}
-				else if (flags[i] == 0) {
-					flags[i] = 1;
-					carried = true;
-					break;
-				}
+			// update the minimum stddev
+			if (stddev < min_stddev) {
+				min_stddev = stddev;
+				min_lines = lines;
 			}
-			if (!carried) break;
 		}
 
+		// if no subset is valid, keep all the lines
+		if (min_lines.empty()) return;
+
 		std::vector<float> tmp = split_positions;
 		split_positions.clear();
-		for (int i = 0; i < tmp.size(); ++i) {
-			if (i == 0 || i == tmp.size() - 1) {
-				split_positions.push_back(tmp[i]);
-			}
-			else if (min_flags[i - 1] == 1) {
-				split_positions.push_back(tmp[i]);
-			}
+		for (int i = 0; i < min_lines.size(); ++i) {
+			split_positions.push_back(tmp[min_lines[i]]);
 		}
 	}
 
@@ -1012,43 +1115,138 @@ namespace fs {
 		}
 	}
 
-	void align(const cv::Mat& edge_img, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>> &winpos, int max_iter) {
-		// 窓のX座標をvoteする
-		for (int j = 0; j < x_split.size() - 1; ++j) {
-			int max_left, max_right;
+	/**
+	* 重み付きの値のGaussian kernel density (sigma) が最大となる、[0, size) の整数を返却する。
+	* 値はソート済みで、同じ値をまとめてから、各distinct valueからmean-shiftを最大max_iter回行い、
+	* 収束点に最も近い整数から、整数上の密度で山登りして極大に達した整数どうしを比べる。密度が同じ場合は、小さい方を返す。
+	* mean-shiftがmax_iter回で収束しなくても山登りで極大には達するので、結果は整数上の密度の極大値のうち、
+	* いずれかのdistinct valueから到達できたものの最大となる。極大が全てのdistinct valueから到達できれば、
+	* 全ての整数の密度のargmaxと一致する (max_iterが小さいと、到達できない極大を見落とす可能性がある)。
+	* [0, size) の全ての整数で密度が0 (全ての値がkernelの半径より離れている) の場合は、-1を返す。
+	*
+	* @param values		ソート済みの値
+	* @param gaussian		Gaussian kernel
+	* @param max_iter		mean-shiftの最大の繰り返し回数
+	* @param size			返却値の範囲
+	* @return				密度が最大の整数
+	*/
+	static int findMode(const std::vector<int>& values, const utils::GaussianKernel& gaussian, int max_iter, int size) {
+		const std::vector<float>& kernel = gaussian.weights();
+		int radius = gaussian.radius();
+		float sigma = gaussian.sigma();
+
+		// distinct values and their counts
+		std::vector<int> distinct;
+		std::vector<int> counts;
+		for (int k = 0; k < values.size(); ++k) {
+			if (k > 0 && values[k] == values[k - 1]) {
+				counts.back()++;
+			}
+			else {
+				distinct.push_back(values[k]);
+				counts.push_back(1);
+			}
+		}
+
+		// kernel density at an integer position
+		auto density = [&](int x) {
+			float total = 0.0f;
+			for (int k = std::lower_bound(distinct.begin(), distinct.end(), x - radius) - distinct.begin(); k < distinct.size() && distinct[k] <= x + radius; ++k) {
+				total += counts[k] * kernel[std::abs(distinct[k] - x)];
+			}
+			return total;
+		};
+
+		int best = -1;
+		float best_density = 0.0f;
+		for (int k = 0; k < distinct.size(); ++k) {
+			// mean-shift from the value
+			float y = distinct[k];
+			for (int iter = 0; iter < max_iter; ++iter) {
+				float total = 0.0f;
+				float weighted_total = 0.0f;
+				for (int l = std::lower_bound(distinct.begin(), distinct.end(), (int)std::floor(y - radius)) - distinct.begin(); l < distinct.size() && distinct[l] <= y + radius; ++l) {
+					float w = counts[l] * std::exp(-(distinct[l] - y) * (distinct[l] - y) / 2.0f / sigma / sigma);
+					total += w;
+					weighted_total += w * distinct[l];
+				}
+				float new_y = weighted_total / total;
+				bool converged = std::abs(new_y - y) < 0.01f;
+				y = new_y;
+				if (converged) break;
+			}
+
+			// climb the integer density from the integer closest to the mode
+			// (to the left also on a tie, so that the smallest integer of a plateau is taken)
+			int c = std::min(std::max(cvRound(y), 0), size - 1);
+			float d = density(c);
+			while (true) {
+				if (c > 0 && density(c - 1) >= d && density(c - 1) > 0) {
+					c--;
+				}
+				else if (c < size - 1 && density(c + 1) > d) {
+					c++;
+				}
+				else {
+					break;
+				}
+				d = density(c);
+			}
 
-			// voteする
-			std::vector<float> histogram1(x_split[j + 1] - x_split[j], 0);
-			std::vector<float> histogram2(x_split[j + 1] - x_split[j], 0);
-			int count = 0;
-			for (int i = 0; i < y_split.size() - 1; ++i) {
+			if (d > best_density || (d == best_density && d > 0 && c < best)) {
+				best_density = d;
+				best = c;
+			}
+		}
+
+		return best;
+	}
+
+	/**
+	* 窓の座標を、カラムごと (left/right) とフロアごと (top/bottom) にそろえる。
+	* 各カラム、各フロアの座標を1回の走査で集めてソートし、mean-shiftで最頻値を求める。
+	* edge_imgは使用しない。
+	*
+	* @param edge_img		edge image
+	* @param y_split		y coordinates of the floor boundaries
+	* @param x_split		x coordinates of the column boundaries
+	* @param winpos		[IN/OUT] windows of each tile
+	* @param max_iter		mean-shiftの最大の繰り返し回数
+	*/
+	void align(const cv::Mat& edge_img, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>> &winpos, int max_iter) {
+		int num_floors = y_split.size() - 1;
+		int num_columns = x_split.size() - 1;
+
+		// 窓の座標を、カラムごとおよびフロアごとに集める
+		std::vector<std::vector<int>> lefts(num_columns), rights(num_columns);
+		std::vector<std::vector<int>> tops(num_floors), bottoms(num_floors);
+		for (int i = 0; i < num_floors; ++i) {
+			for (int j = 0; j < num_columns; ++j) {
 				if (!winpos[i][j].valid) continue;
 
-				count++;
-				for (int c = 0; c < histogram1.size(); ++c) {
-					histogram1[c] += utils::gause(winpos[i][j].left - c, 2);
-					histogram2[c] += utils::gause(winpos[i][j].right - c, 2);
-				}
+				lefts[j].push_back(winpos[i][j].left);
+				rights[j].push_back(winpos[i][j].right);
+				tops[i].push_back(winpos[i][j].top);
+				bottoms[i].push_back(winpos[i][j].bottom);
 			}
+		}
 
-			if (count == 0) continue;
+		// voteのkernelは、全てのカラム、フロアで共有する
+		utils::GaussianKernel gaussian(2);
 
-			// max voteを探す
-			float max_val1 = 0.0f;
-			float max_val2 = 0.0f;
-			for (int c = 0; c < histogram1.size(); ++c) {
-				if (histogram1[c] > max_val1) {
-					max_val1 = histogram1[c];
-					max_left = c;
-				}
-				if (histogram2[c] > max_val2) {
-					max_val2 = histogram2[c];
-					max_right = c;
-				}
-			}
+		// 窓のX座標の最頻値を求める
+		for (int j = 0; j < num_columns; ++j) {
+			int width = x_split[j + 1] - x_split[j];
+			if (lefts[j].empty() || width <= 0) continue;
+
+			std::sort(lefts[j].begin(), lefts[j].end());
+			std::sort(rights[j].begin(), rights[j].end());
+			int max_left = findMode(lefts[j], gaussian, max_iter, width);
+			int max_right = findMode(rights[j], gaussian, max_iter, width);
+			if (max_left < 0 || max_right < 0) continue;
 
 			// 全てのフロアの窓のX座標をそろえる
-			for (int r = 0; r < y_split.size() - 1; ++r) {
+			for (int r = 0; r < num_floors; ++r) {
 				if (!winpos[r][j].valid) continue;
 
 				if (r == 0 || r == y_split.size() - 1) {
@@ -1066,48 +1264,187 @@ namespace fs {
 			}
 		}
 
-		// 窓のY座標をvoteする
-		for (int i = 0; i < y_split.size() - 1; ++i) {
-			int max_top, max_bottom;
+		// 窓のY座標の最頻値を求める
+		for (int i = 0; i < num_floors; ++i) {
+			int height = y_split[i + 1] - y_split[i];
+			if (tops[i].empty() || height <= 0) continue;
 
-			// voteする
-			std::vector<float> histogram1(y_split[i + 1] - y_split[i], 0);
-			std::vector<float> histogram2(y_split[i + 1] - y_split[i], 0);
-			int count = 0;
-			for (int j = 0; j < x_split.size() - 1; ++j) {
-				if (!winpos[i][j].valid) continue;
+			std::sort(tops[i].begin(), tops[i].end());
+			std::sort(bottoms[i].begin(), bottoms[i].end());
+			int max_top = findMode(tops[i], gaussian, max_iter, height);
+			int max_bottom = findMode(bottoms[i], gaussian, max_iter, height);
+			if (max_top < 0 || max_bottom < 0) continue;
 
-				count++;
-				for (int r = 0; r < histogram1.size(); ++r) {
-					histogram1[r] += utils::gause(winpos[i][j].top - r, 2);
-					histogram2[r] += utils::gause(winpos[i][j].bottom - r, 2);
-				}
+			// 全てのカラムの窓のY座標をそろえる
+			for (int c = 0; c < num_columns; ++c) {
+				if (!winpos[i][c].valid) continue;
+
+				winpos[i][c].top = max_top;
+				winpos[i][c].bottom = max_bottom;
 			}
+		}
+	}
 
-			if (count == 0) continue;
+	/**
+	* 窓のエネルギーを返却する。
+	* 4辺それぞれの上のedge画素の割合の和を負にしたものに、カラム/フロアの代表座標 (target) からのずれ
+	* (tileの幅/高さで正規化) のlambda倍を足す。各辺のedgeの数はEdgeIntegralからO(1)で求まる。
+	*
+	* @param win			窓 (tileに対する相対座標)
+	* @param tile			tile
+	* @param edges			edge integral of the facade
+	* @param target		カラムのleft/rightとフロアのtop/bottomの代表値
+	* @param lambda		ずれの重み
+	* @return				エネルギー
+	*/
+	float computeEnergy(const WindowPos& win, const cv::Rect& tile, const EdgeIntegral& edges, const WindowPos& target, float lambda) {
+		int x1 = tile.x + win.left;
+		int x2 = tile.x + win.right;
+		int y1 = tile.y + win.top;
+		int y2 = tile.y + win.bottom;
+		float w = x2 - x1 + 1;
+		float h = y2 - y1 + 1;
+
+		float support = edges.countCol(x1, y1, y2 + 1) / h + edges.countCol(x2, y1, y2 + 1) / h
+			+ edges.countRow(y1, x1, x2 + 1) / w + edges.countRow(y2, x1, x2 + 1) / w;
+		float deviation = (float)(std::abs(win.left - target.left) + std::abs(win.right - target.right)) / tile.width
+			+ (float)(std::abs(win.top - target.top) + std::abs(win.bottom - target.bottom)) / tile.height;
+
+		return -support + lambda * deviation;
+	}
 
-			// max voteを探す
-			float max_val1 = 0.0f;
-			float max_val2 = 0.0f;
-			for (int r = 0; r < histogram1.size(); ++r) {
-				if (histogram1[r] > max_val1) {
-					max_val1 = histogram1[r];
-					max_top = r;
+	/**
+	* 窓の各辺をedgeに合わせるように、エネルギー最小化で窓の位置を修正する。
+	* 各iterationで、カラムごとのleft/right、フロアごとのtop/bottomの中央値を代表値とし、
+	* 各窓の各辺を現在の位置の +/- radius の範囲で動かしてエネルギーが最小の位置を選ぶ (coordinate descent)。
+	* 探索範囲を限定するので、辺が遠くのedge (コーニス、窓台、tileの境界など) に飛ぶことはない。
+	* 変化がなくなるか、max_iter回繰り返したら終了する。
+	*
+	* @param edges			edge integral of the facade
+	* @param y_split		y coordinates of the floor boundaries
+	* @param x_split		x coordinates of the column boundaries
+	* @param winpos		[IN/OUT] windows of each tile
+	* @param max_iter		最大の繰り返し回数
+	* @param lambda		代表値からのずれの重み
+	* @param radius		各辺の探索範囲
+	*/
+	void refineWindows(const EdgeIntegral& edges, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, int max_iter, float lambda, int radius) {
+		int num_floors = y_split.size() - 1;
+		int num_columns = x_split.size() - 1;
+
+		for (int iter = 0; iter < max_iter; ++iter) {
+			// カラム/フロアごとの代表値 (中央値)
+			std::vector<WindowPos> column_targets(num_columns), floor_targets(num_floors);
+			for (int j = 0; j < num_columns; ++j) {
+				std::vector<int> lefts, rights;
+				for (int i = 0; i < num_floors; ++i) {
+					if (winpos[i][j].valid != WindowPos::VALID) continue;
+					lefts.push_back(winpos[i][j].left);
+					rights.push_back(winpos[i][j].right);
 				}
-				if (histogram2[r] > max_val2) {
-					max_val2 = histogram2[r];
-					max_bottom = r;
+				if (lefts.empty()) continue;
+				std::nth_element(lefts.begin(), lefts.begin() + lefts.size() / 2, lefts.end());
+				std::nth_element(rights.begin(), rights.begin() + rights.size() / 2, rights.end());
+				column_targets[j].left = lefts[lefts.size() / 2];
+				column_targets[j].right = rights[rights.size() / 2];
+			}
+			for (int i = 0; i < num_floors; ++i) {
+				std::vector<int> tops, bottoms;
+				for (int j = 0; j < num_columns; ++j) {
+					if (winpos[i][j].valid != WindowPos::VALID) continue;
+					tops.push_back(winpos[i][j].top);
+					bottoms.push_back(winpos[i][j].bottom);
+				}
+				if (tops.empty()) continue;
+				std::nth_element(tops.begin(), tops.begin() + tops.size() / 2, tops.end());
+				std::nth_element(bottoms.begin(), bottoms.begin() + bottoms.size() / 2, bottoms.end());
+				floor_targets[i].top = tops[tops.size() / 2];
+				floor_targets[i].bottom = bottoms[bottoms.size() / 2];
+			}
+
+			bool changed = false;
+			for (int i = 0; i < num_floors; ++i) {
+				for (int j = 0; j < num_columns; ++j) {
+					WindowPos& win = winpos[i][j];
+					if (win.valid != WindowPos::VALID) continue;
+
+					cv::Rect tile(x_split[j], y_split[i], x_split[j + 1] - x_split[j], y_split[i + 1] - y_split[i]);
+					if (win.left < 0 || win.top < 0 || win.left >= win.right || win.top >= win.bottom || win.right >= tile.width || win.bottom >= tile.height) continue;
+
+					WindowPos target(column_targets[j].left, floor_targets[i].top, column_targets[j].right, floor_targets[i].bottom);
+
+					// 各辺を、他の辺を固定して最適な位置に動かす
+					int* sides[4] = { &win.left, &win.right, &win.top, &win.bottom };
+					for (int s = 0; s < 4; ++s) {
+						int original = *sides[s];
+						int lo, hi;
+						if (s == 0) { lo = 0; hi = win.right - 1; }
+						else if (s == 1) { lo = win.left + 1; hi = tile.width - 1; }
+						else if (s == 2) { lo = 0; hi = win.bottom - 1; }
+						else { lo = win.top + 1; hi = tile.height - 1; }
+						lo = std::max(lo, original - radius);
+						hi = std::min(hi, original + radius);
+
+						int best = original;
+						float min_energy = computeEnergy(win, tile, edges, target, lambda);
+						for (int pos = lo; pos <= hi; ++pos) {
+							*sides[s] = pos;
+							float energy = computeEnergy(win, tile, edges, target, lambda);
+							if (energy < min_energy) {
+								min_energy = energy;
+								best = pos;
+							}
+						}
+						*sides[s] = best;
+						if (best != original) changed = true;
+					}
 				}
 			}
 
-			// 全てのカラムの窓のY座標をそろえる
-			for (int c = 0; c < x_split.size() - 1; ++c) {
-				if (!winpos[i][c].valid) continue;
+			if (!changed) break;
+		}
+	}
 
-				winpos[i][c].top = max_top;
-				winpos[i][c].bottom = max_bottom;
+	/**
+	 * Find the local minima of a profile and their prominence in O(N).
+	 * The prominence of each side is measured up to the nearest strictly smaller value:
+	 * the larger one of the rise before it and the drop to it (infinite if the end of the profile is reached first).
+	 * The prominence of a minimum is the smaller one of both sides, so that
+	 * isLocalMinimum(mat, index, threshold) is true iff the minimum at index has prominence > threshold.
+	 *
+	 * @param val		profile (column or row vector)
+	 * @param minima	[OUT] pairs of (index, prominence) in ascending order of index
+	 */
+	void findMinima(const cv::Mat_<float>& val, std::vector<std::pair<int, float>>& minima) {
+		minima.clear();
+
+		cv::Mat_<float> mat = val.isContinuous() ? val : val.clone();
+		int n = mat.total();
+		const float* v = mat.ptr<float>(0);
+
+		// for each direction, the highest value between each index and the nearest strictly smaller value
+		// is obtained by a monotonic stack of (index, highest value of the range covered by the index)
+		std::vector<float> side[2];
+		for (int d = 0; d < 2; ++d) {
+			side[d].assign(n, std::numeric_limits<float>::infinity());
+			std::vector<std::pair<int, float>> stack;
+			for (int k = 0; k < n; ++k) {
+				int i = d == 0 ? k : n - 1 - k;
+				float highest = -std::numeric_limits<float>::infinity();
+				while (!stack.empty() && v[stack.back().first] >= v[i]) {
+					highest = std::max(highest, stack.back().second);
+					stack.pop_back();
+				}
+				if (!stack.empty()) {
+					side[d][i] = std::max(highest - v[i], v[i] - v[stack.back().first]);
+				}
+				stack.push_back(std::make_pair(i, std::max(highest, v[i])));
 			}
 		}
+
+		for (int i = 0; i < n; ++i) {
+			minima.push_back(std::make_pair(i, std::min(side[0][i], side[1][i])));
+		}
 	}
 
 	bool isLocalMinimum(const cv::Mat& mat, int index, float threshold) {
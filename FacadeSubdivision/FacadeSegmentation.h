@@ -2,6 +2,10 @@
 
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include "GradientIntegral.h"
+#include "EdgeIntegral.h"
+#include "TileClassifier.h"
+#include "MinimaHierarchy.h"
 
 namespace fs {
 
@@ -20,24 +24,52 @@ namespace fs {
 		WindowPos(int left, int top, int right, int bottom) : left(left), top(top), right(right), bottom(bottom), valid(VALID) {}
 	};
 
-	void subdivideFacade(const cv::Mat& img, int num_floors, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects);
+	class SplitConfiguration {
+	public:
+		std::vector<int> positions;	// split lines including the both ends
+		float cost;					// average of Ver/Hor at the split lines (lower is better)
+
+	public:
+		SplitConfiguration() : cost(0) {}
+	};
+
+	class RefinementOptions {
+	public:
+		bool enabled;		// true: refineWindows is run after the window detection (and the alignment)
+		int max_iter;		// maximum number of coordinate descent iterations
+		float lambda;		// weight of the deviation from the column/floor medians (not tuned on testdata/ yet)
+		int radius;			// each side of a window moves within +/- radius pixels of its current position
+
+	public:
+		RefinementOptions() : enabled(false), max_iter(5), lambda(1.0f), radius(3) {}
+	};
+
+	void subdivideFacade(const cv::Mat& img, int num_floors, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects, bool skip_blank_tiles = false, TileStats* stats = NULL, const RefinementOptions& refinement = RefinementOptions());
 	float MI(const cv::Mat& R1, const cv::Mat& R2);
 	void computeSV(const cv::Mat& img, cv::Mat_<float>& SV_max, cv::Mat_<float>& h_max, const std::pair<int, int>& h_range);
 	void computeSH(const cv::Mat& img, cv::Mat_<float>& SH_max, cv::Mat_<float>& w_max, const std::pair<int, int>& w_range);
 	void computeVerAndHor(const cv::Mat& img, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor);
 	void computeVerAndHor(const cv::Mat& img, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor, float sigma);
 	void computeVerAndHor2(const cv::Mat& img, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor);
+	void computeVerAndHor2(const GradientIntegral& grad, const cv::Rect& rect, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor);
 	bool subdivideTile(const cv::Mat& tile, const cv::Mat& edges, int min_size, int tile_margin, WindowPos& winpos);
+	bool subdivideTile(const cv::Mat& tile, const EdgeIntegral& edges, const cv::Rect& rect, int min_size, int tile_margin, WindowPos& winpos);
 	bool subdivideTile2(const cv::Mat& tile, cv::Mat Ver, cv::Mat Hor, int min_size, int tile_margin, WindowPos& winpos);
 	void findBestHorizontalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Ver, float min_interval, float max_interval, std::vector<int>& y_split);
 	void findBestVerticalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Hor, float min_interval, float max_interval, std::vector<int>& x_split);
+	void findKBestHorizontalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Ver, float min_interval, float max_interval, int K, std::vector<SplitConfiguration>& configs);
+	void findKBestVerticalSplitLines(const cv::Mat& img, const cv::Mat_<float>& Hor, float min_interval, float max_interval, int K, std::vector<SplitConfiguration>& configs);
+	void findKBestSplitLines(const std::vector<int>& candidates, const cv::Mat_<float>& profile, float min_interval, float max_interval, int K, std::vector<SplitConfiguration>& configs);
 	void getSplitLines(const cv::Mat_<float>& mat, float threshold, std::vector<float>& split_positions);
+	void getSplitLines(const MinimaHierarchy& hierarchy, float threshold, std::vector<float>& split_positions);
 	void refineSplitLines(std::vector<float>& split_positions, float avg_size, float threshold);
 	void refineSplitLines(std::vector<float>& split_positions, float threshold);
 	void distributeSplitLines(std::vector<float>& split_positions, float threshold);
 	void refine(std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, float threshold);
 	void align(const cv::Mat& edge_img, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, int max_iter);
-	//float computeEnergy(std::vector<std::vector<WindowPos>> &winpos, int u, int v, const std::vector<float>& y_split, const std::vector<float>& x_split, const cv::Mat& edge_img);
+	float computeEnergy(const WindowPos& win, const cv::Rect& tile, const EdgeIntegral& edges, const WindowPos& target, float lambda);
+	void refineWindows(const EdgeIntegral& edges, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, int max_iter, float lambda, int radius);
+	void findMinima(const cv::Mat_<float>& val, std::vector<std::pair<int, float>>& minima);
 	bool isLocalMinimum(const cv::Mat& mat, int index, float threshold);
 
 	// visualization
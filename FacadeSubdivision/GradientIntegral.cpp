@@ -0,0 +1,82 @@
+#include "GradientIntegral.h"
+#include "CVUtils.h"
+
+namespace fs {
+
+	namespace {
+		int reflect101(int i, int n) {
+			if (n == 1) return 0;
+			if (i < 0) return -i;
+			if (i >= n) return n * 2 - 2 - i;
+			return i;
+		}
+	}
+
+	GradientIntegral::GradientIntegral() : rows(0), cols(0) {
+	}
+
+	/**
+	 * Compute the gradient magnitudes of the facade and their prefix sums.
+	 *
+	 * @param img		facade image (1-channel or 3-channel image)
+	 */
+	GradientIntegral::GradientIntegral(const cv::Mat& img) : rows(img.rows), cols(img.cols) {
+		cv::Mat gray;
+		cvutils::grayScale(img, gray);
+
+		x_row_table = cv::Mat_<int>(rows, cols + 1, 0);
+		y_row_table = cv::Mat_<int>(rows, cols + 1, 0);
+		x_col_table = cv::Mat_<int>(rows + 1, cols, 0);
+		y_col_table = cv::Mat_<int>(rows + 1, cols, 0);
+
+		for (int r = 0; r < rows; ++r) {
+			const unsigned char* p0 = gray.ptr<unsigned char>(reflect101(r - 1, rows));
+			const unsigned char* p1 = gray.ptr<unsigned char>(r);
+			const unsigned char* p2 = gray.ptr<unsigned char>(reflect101(r + 1, rows));
+			int* x_row = x_row_table.ptr<int>(r);
+			int* y_row = y_row_table.ptr<int>(r);
+			const int* x_col_prev = x_col_table.ptr<int>(r);
+			const int* y_col_prev = y_col_table.ptr<int>(r);
+			int* x_col = x_col_table.ptr<int>(r + 1);
+			int* y_col = y_col_table.ptr<int>(r + 1);
+
+			for (int c = 0; c < cols; ++c) {
+				int cl = reflect101(c - 1, cols);
+				int cr = reflect101(c + 1, cols);
+				int gx = std::abs((p0[cr] + p1[cr] * 2 + p2[cr]) - (p0[cl] + p1[cl] * 2 + p2[cl]));
+				int gy = std::abs((p2[cl] + p2[c] * 2 + p2[cr]) - (p0[cl] + p0[c] * 2 + p0[cr]));
+
+				x_row[c + 1] = x_row[c] + gx;
+				y_row[c + 1] = y_row[c] + gy;
+				x_col[c] = x_col_prev[c] + gx;
+				y_col[c] = y_col_prev[c] + gy;
+			}
+		}
+	}
+
+	/**
+	 * Return the row sums and column sums of |Gx| and |Gy| inside the rectangle.
+	 *
+	 * @param rect		rectangle
+	 * @param x_rows	sum of |Gx| for each row (height x 1)
+	 * @param x_cols	sum of |Gx| for each column (1 x width)
+	 * @param y_rows	sum of |Gy| for each row (height x 1)
+	 * @param y_cols	sum of |Gy| for each column (1 x width)
+	 */
+	void GradientIntegral::sum(const cv::Rect& rect, cv::Mat_<float>& x_rows, cv::Mat_<float>& x_cols, cv::Mat_<float>& y_rows, cv::Mat_<float>& y_cols) const {
+		x_rows = cv::Mat_<float>(rect.height, 1);
+		y_rows = cv::Mat_<float>(rect.height, 1);
+		for (int r = 0; r < rect.height; ++r) {
+			x_rows(r, 0) = x_row_table(rect.y + r, rect.x + rect.width) - x_row_table(rect.y + r, rect.x);
+			y_rows(r, 0) = y_row_table(rect.y + r, rect.x + rect.width) - y_row_table(rect.y + r, rect.x);
+		}
+
+		x_cols = cv::Mat_<float>(1, rect.width);
+		y_cols = cv::Mat_<float>(1, rect.width);
+		for (int c = 0; c < rect.width; ++c) {
+			x_cols(0, c) = x_col_table(rect.y + rect.height, rect.x + c) - x_col_table(rect.y, rect.x + c);
+			y_cols(0, c) = y_col_table(rect.y + rect.height, rect.x + c) - y_col_table(rect.y, rect.x + c);
+		}
+	}
+
+}
@@ -0,0 +1,63 @@
+#include "TileClassifier.h"
+#include "CVUtils.h"
+
+namespace fs {
+
+	namespace {
+		double rectSum(const cv::Mat& integral, const cv::Rect& rect) {
+			return integral.at<double>(rect.y + rect.height, rect.x + rect.width) - integral.at<double>(rect.y, rect.x + rect.width)
+				- integral.at<double>(rect.y + rect.height, rect.x) + integral.at<double>(rect.y, rect.x);
+		}
+	}
+
+	TileClassifier::TileClassifier() : max_stddev(0), max_gradient(0) {
+	}
+
+	/**
+	 * Compute the integral images of the facade.
+	 *
+	 * @param img				facade image (1-channel or 3-channel image)
+	 * @param max_stddev		maximum intensity stddev of a blank tile
+	 * @param max_gradient		maximum mean gradient energy (|Gx| + |Gy|) of a blank tile
+	 */
+	TileClassifier::TileClassifier(const cv::Mat& img, float max_stddev, float max_gradient) : max_stddev(max_stddev), max_gradient(max_gradient) {
+		cv::Mat gray;
+		cvutils::grayScale(img, gray);
+		cv::integral(gray, sum, sqsum, CV_64F, CV_64F);
+
+		cv::Mat sobelx, sobely;
+		cv::Sobel(gray, sobelx, CV_32F, 1, 0);
+		cv::Sobel(gray, sobely, CV_32F, 0, 1);
+		cv::Mat grad_mag = cv::abs(sobelx) + cv::abs(sobely);
+		cv::integral(grad_mag, grad_sum, CV_64F);
+	}
+
+	/**
+	 * Return the intensity stddev and the mean gradient energy of the tile.
+	 *
+	 * @param rect			tile
+	 * @param stddev		[OUT] stddev of the intensity
+	 * @param gradient		[OUT] mean of |Gx| + |Gy|
+	 */
+	void TileClassifier::statistics(const cv::Rect& rect, float& stddev, float& gradient) const {
+		double area = rect.area();
+		double mean = rectSum(sum, rect) / area;
+		double variance = rectSum(sqsum, rect) / area - mean * mean;
+		stddev = std::sqrt(std::max(0.0, variance));
+		gradient = rectSum(grad_sum, rect) / area;
+	}
+
+	/**
+	 * Return true if the tile has no structure.
+	 *
+	 * @param rect			tile
+	 */
+	bool TileClassifier::isBlank(const cv::Rect& rect) const {
+		if (rect.area() <= 0) return true;
+
+		float stddev, gradient;
+		statistics(rect, stddev, gradient);
+		return stddev < max_stddev && gradient < max_gradient;
+	}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace fs {
+
+	/**
+	 * Cheap pre-classifier of tiles.
+	 * The integral images of the intensity, the squared intensity and the gradient energy (|Gx| + |Gy|) of a whole facade
+	 * are computed once, so that the intensity stddev and the mean gradient energy of any tile are obtained in O(1).
+	 * A tile whose both values are below the thresholds (plain wall, sky, etc.) is regarded as blank,
+	 * and the window detection can be skipped for it.
+	 */
+	class TileClassifier {
+	private:
+		cv::Mat sum;		// (rows + 1) x (cols + 1): integral of the intensity
+		cv::Mat sqsum;		// (rows + 1) x (cols + 1): integral of the squared intensity
+		cv::Mat grad_sum;	// (rows + 1) x (cols + 1): integral of |Gx| + |Gy|
+		float max_stddev;
+		float max_gradient;
+
+	public:
+		TileClassifier();
+		TileClassifier(const cv::Mat& img, float max_stddev = 4.0f, float max_gradient = 8.0f);
+
+		bool empty() const { return sum.empty(); }
+		void statistics(const cv::Rect& rect, float& stddev, float& gradient) const;
+		bool isBlank(const cv::Rect& rect) const;
+	};
+
+	class TileStats {
+	public:
+		long long num_tiles;		// number of tiles
+		long long num_skipped;		// number of tiles classified as blank
+		long long num_false_skips;	// number of skipped tiles in which the detector finds a window
+		long long num_detections;	// number of tiles on which the detector is run (except for counting the false skips)
+
+	public:
+		TileStats() : num_tiles(0), num_skipped(0), num_false_skips(0), num_detections(0) {}
+	};
+
+}
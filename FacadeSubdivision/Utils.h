@@ -3,6 +3,7 @@
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <memory>
 
 namespace utils {
 
@@ -11,4 +12,26 @@ namespace utils {
 	float stddev(std::vector<float> list);
 
 	std::vector<int> findBestAssignment(const std::vector<int>& labels1, const std::vector<int>& labels2);
+
+	/**
+	 * 打ち切ったGaussian kernelのテーブル。
+	 * weights()[k] = gause(k, sigma) (k = 0, ..., radius) をsigmaごとに1回だけ計算してキャッシュする。
+	 * radiusは6 sigmaで、その外側の重みは中心に対してfloatの精度以下 (exp(-18)) なので、
+	 * gauseを全ての位置について足し合わせた結果とは、floatの誤差の範囲で一致する。
+	 * テーブルはインスタンスが共有して保持するので、ループの外で1回だけ作って使い回す。
+	 */
+	class GaussianKernel {
+	private:
+		float sigma_;
+		std::shared_ptr<const std::vector<float> > table;
+
+	public:
+		GaussianKernel(float sigma);
+
+		float sigma() const { return sigma_; }
+		int radius() const { return table->size() - 1; }
+		const std::vector<float>& weights() const { return *table; }
+		void splat(std::vector<float>& histogram, float u, float weight = 1.0f) const;
+		void convolve(const std::vector<float>& src, std::vector<float>& dst) const;
+	};
 }
\ No newline at end of file
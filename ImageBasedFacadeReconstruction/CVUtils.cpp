@@ -443,15 +443,30 @@ namespace cvutils {
 	float getMostPopularValue(const cv::Mat& h_max, float sigma, float min_value) {
 		vector<float> histogram((int)cvutils::max(h_max), 0.0f);
 
+		// 整数の値は画素数を数えて、値ごとに1回だけGaussianを足す
+		// (histogramからkernelの半径より離れた値は、histogramに寄与しない)
+		utils::GaussianKernel kernel(sigma);
+		int radius = kernel.radius();
+		vector<int> counts(histogram.size() + radius * 2, 0);
 		for (int r = 0; r < h_max.rows; ++r) {
 			for (int c = 0; c < h_max.cols; ++c) {
-				if (get(h_max, r, c) < min_value) continue;
+				double value = get(h_max, r, c);
+				if (value < min_value) continue;
 
-				for (int i = 0; i < histogram.size(); ++i) {
-					histogram[i] += utils::gause(get(h_max, r, c) - i, sigma);
+				if (value == floor(value)) {
+					if (value >= -radius && value < (int)histogram.size() + radius) {
+						counts[(int)value + radius]++;
+					}
+				}
+				else {
+					kernel.splat(histogram, value);
 				}
 			}
 		}
+		for (int v = 0; v < counts.size(); ++v) {
+			if (counts[v] == 0) continue;
+			kernel.splat(histogram, v - radius, counts[v]);
+		}
 
 		float max_value = 0.0f;
 		int max_index = -1;
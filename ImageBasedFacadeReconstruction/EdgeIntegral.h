@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace fs {
+
+	/**
+	 * Bit-packed edge map of a whole facade with popcount prefix tables.
+	 * The edges are stored with 1 bit per pixel both row by row and column by column,
+	 * and the number of edges before each 64-bit word is kept, so that the number of edges of any row segment or column segment
+	 * is obtained in O(1), and the vertical/horizontal projections of any tile in O(h + w).
+	 */
+	class EdgeIntegral {
+	private:
+		int rows;
+		int cols;
+		int row_words;						// #words per row
+		int col_words;						// #words per column
+		std::vector<uint64> row_bits;		// rows x row_words: bit c of row r
+		std::vector<uint64> col_bits;		// cols x col_words: bit r of column c
+		std::vector<int> row_prefix;		// rows x (row_words + 1): #edges of row r before each word
+		std::vector<int> col_prefix;		// cols x (col_words + 1): #edges of column c before each word
+
+	public:
+		EdgeIntegral();
+		EdgeIntegral(const cv::Mat& edge_img);
+
+		int numRows() const { return rows; }
+		int numCols() const { return cols; }
+		int countRow(int r, int c1, int c2) const;
+		int countCol(int c, int r1, int r2) const;
+		void project(const cv::Rect& rect, cv::Mat_<float>& edgeV, cv::Mat_<float>& edgeH) const;
+	};
+
+}
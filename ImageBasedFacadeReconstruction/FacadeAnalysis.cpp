@@ -0,0 +1,168 @@
+#include "FacadeAnalysis.h"
+#include "FacadeSegmentation.h"
+
+namespace fs {
+
+	/**
+	 * @param img						facade image (3-channel color image)
+	 * @param average_floor_height		floor height
+	 * @param average_column_width		column width
+	 */
+	FacadeAnalysis::FacadeAnalysis(const cv::Mat& img, float average_floor_height, float average_column_width) : img(img), average_floor_height(average_floor_height), average_column_width(average_column_width) {
+	}
+
+	/**
+	 * Return the size of the blur kernel for the vertical direction (odd).
+	 */
+	int FacadeAnalysis::kernelSizeV() const {
+		int kernel_size_V = average_floor_height / 8;
+		if (kernel_size_V % 2 == 0) kernel_size_V++;
+		return kernel_size_V;
+	}
+
+	/**
+	 * Return the size of the blur kernel for the horizontal direction (odd).
+	 */
+	int FacadeAnalysis::kernelSizeH() const {
+		int kernel_size_H = average_column_width / 8;
+		if (kernel_size_H % 2 == 0) kernel_size_H++;
+		return kernel_size_H;
+	}
+
+	const cv::Mat& FacadeAnalysis::grayImage() {
+		if (!lookup("gray", !gray_img.empty())) {
+			cv::cvtColor(img, gray_img, cv::COLOR_BGR2GRAY);
+		}
+		return gray_img;
+	}
+
+	/**
+	 * Return the gray image blurred according to the average floor height.
+	 */
+	const cv::Mat& FacadeAnalysis::blurredGrayImage() {
+		if (!lookup("blurred gray", !blurred_gray_img.empty())) {
+			int kernel_size_V = kernelSizeV();
+			if (kernel_size_V > 1) {
+				cv::GaussianBlur(grayImage(), blurred_gray_img, cv::Size(kernel_size_V, kernel_size_V), kernel_size_V);
+			}
+			else {
+				blurred_gray_img = grayImage().clone();
+			}
+		}
+		return blurred_gray_img;
+	}
+
+	/**
+	 * Return Ver(y) of the blurred image, smoothed according to the floor height.
+	 */
+	const cv::Mat_<float>& FacadeAnalysis::ver() {
+		if (!lookup("Ver/Hor", !Ver.empty())) {
+			computeVerAndHor();
+		}
+		return Ver;
+	}
+
+	/**
+	 * Return Hor(x) of the blurred image, smoothed according to the column width.
+	 */
+	const cv::Mat_<float>& FacadeAnalysis::hor() {
+		if (!lookup("Ver/Hor", !Hor.empty())) {
+			computeVerAndHor();
+		}
+		return Hor;
+	}
+
+	/**
+	 * Return the prefix sums of the gradient magnitudes of the (not blurred) gray image.
+	 */
+	const GradientIntegral& FacadeAnalysis::gradientIntegral() {
+		if (!lookup("gradient integral", gradient_integral.numRows() > 0)) {
+			gradient_integral = GradientIntegral(grayImage());
+		}
+		return gradient_integral;
+	}
+
+	/**
+	 * Return the Canny edges of the gray image.
+	 */
+	const cv::Mat& FacadeAnalysis::edgeImage() {
+		if (!lookup("edge", !edge_img.empty())) {
+			cv::Canny(grayImage(), edge_img, 50, 150);
+		}
+		return edge_img;
+	}
+
+	/**
+	 * Return the bit-packed edge map with the popcount prefix tables.
+	 */
+	const EdgeIntegral& FacadeAnalysis::edgeIntegral() {
+		if (!lookup("edge integral", edge_integral.numRows() > 0)) {
+			edge_integral = EdgeIntegral(edgeImage());
+		}
+		return edge_integral;
+	}
+
+	/**
+	 * Return the classifier of blank tiles, which is based on the integral images of the gray image.
+	 */
+	const TileClassifier& FacadeAnalysis::tileClassifier() {
+		if (!lookup("tile classifier", !tile_classifier.empty())) {
+			tile_classifier = TileClassifier(grayImage());
+		}
+		return tile_classifier;
+	}
+
+	/**
+	 * Return the integral histogram of the blurred gray image.
+	 */
+	const IntegralHistogram& FacadeAnalysis::integralHistogram() {
+		if (!lookup("integral histogram", integral_histogram.numBins() > 0)) {
+			integral_histogram = IntegralHistogram(blurredGrayImage());
+		}
+		return integral_histogram;
+	}
+
+	/**
+	 * Output the number of hits and misses of each intermediate.
+	 */
+	void FacadeAnalysis::printStats(std::ostream& out) const {
+		for (auto it = counters.begin(); it != counters.end(); ++it) {
+			out << "  " << it->first << ": " << it->second.first << " hits, " << it->second.second << " misses" << std::endl;
+		}
+	}
+
+	/**
+	 * Count a hit or a miss of the intermediate.
+	 *
+	 * @param name		name of the intermediate
+	 * @param cached	true if it has been computed
+	 * @return			cached
+	 */
+	bool FacadeAnalysis::lookup(const std::string& name, bool cached) {
+		if (cached) {
+			counters[name].first++;
+		}
+		else {
+			counters[name].second++;
+		}
+		return cached;
+	}
+
+	/**
+	 * Compute Ver(y) and Hor(x) of the blurred image, and smooth them according to the floor height and the column width.
+	 */
+	void FacadeAnalysis::computeVerAndHor() {
+		computeVerAndHor2(blurredGrayImage(), Ver, Hor, 0.0);
+
+		// smooth Ver and Hor
+		int kernel_size_V = kernelSizeV();
+		int kernel_size_H = kernelSizeH();
+		if (kernel_size_V > 1) {
+			cv::blur(Ver, Ver, cv::Size(kernel_size_V, kernel_size_V));
+		}
+		if (kernel_size_H > 1) {
+			cv::blur(Hor, Hor, cv::Size(kernel_size_H, kernel_size_H));
+		}
+	}
+
+}
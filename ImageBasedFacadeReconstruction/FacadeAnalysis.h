@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include "GradientIntegral.h"
+#include "EdgeIntegral.h"
+#include "TileClassifier.h"
+#include "IntegralHistogram.h"
+
+namespace fs {
+
+	/**
+	 * Per-image analysis context of a facade.
+	 * The intermediates (gray image, blurred image, Ver/Hor, gradient integral, edge map and its bit-packed integral, tile classifier, integral histogram)
+	 * are computed the first time they are requested and cached, so that the segmentation, the window extraction
+	 * and the visualization share them. The number of hits and misses of each intermediate is counted.
+	 */
+	class FacadeAnalysis {
+	private:
+		cv::Mat img;
+		float average_floor_height;
+		float average_column_width;
+
+		cv::Mat gray_img;
+		cv::Mat blurred_gray_img;
+		cv::Mat_<float> Ver;
+		cv::Mat_<float> Hor;
+		cv::Mat edge_img;
+		GradientIntegral gradient_integral;
+		EdgeIntegral edge_integral;
+		TileClassifier tile_classifier;
+		IntegralHistogram integral_histogram;
+
+		// hits and misses of each intermediate
+		std::map<std::string, std::pair<int, int> > counters;
+
+	public:
+		FacadeAnalysis(const cv::Mat& img, float average_floor_height, float average_column_width);
+
+		const cv::Mat& image() const { return img; }
+		float floorHeight() const { return average_floor_height; }
+		float columnWidth() const { return average_column_width; }
+		int kernelSizeV() const;
+		int kernelSizeH() const;
+
+		const cv::Mat& grayImage();
+		const cv::Mat& blurredGrayImage();
+		const cv::Mat_<float>& ver();
+		const cv::Mat_<float>& hor();
+		const GradientIntegral& gradientIntegral();
+		const cv::Mat& edgeImage();
+		const EdgeIntegral& edgeIntegral();
+		const TileClassifier& tileClassifier();
+		const IntegralHistogram& integralHistogram();
+
+		void printStats(std::ostream& out) const;
+
+	private:
+		bool lookup(const std::string& name, bool cached);
+		void computeVerAndHor();
+	};
+
+}
@@ -1,43 +1,37 @@
 ﻿#include "FacadeSegmentation.h"
 #include "CVUtils.h"
 #include "Utils.h"
+#include "JointHistogram.h"
+#include "IntegralHistogram.h"
+#include "GradientIntegral.h"
+#include "EdgeIntegral.h"
+#include "TileClassifier.h"
 #include <fstream>
 #include <list>
+#include <limits>
 
 namespace fs {
 	int seq = 0;
 
 	void subdivideFacade(cv::Mat img, float average_floor_height, float average_column_width, bool align_windows, std::vector<float>& y_splits, std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects) {
-		// gray scale
-		cv::Mat gray_img;
-		cv::cvtColor(img, gray_img, cv::COLOR_BGR2GRAY);
-		
-		// compute kernel size
-		int kernel_size_V = average_floor_height / 8;
-		if (kernel_size_V % 2 == 0) kernel_size_V++;
-		int kernel_size_H = average_column_width / 8;
-		if (kernel_size_H % 2 == 0) kernel_size_H++;
-
-		// blur the image according to the average floor height
-		cv::Mat blurred_gray_img;
-		if (kernel_size_V > 1) {
-			cv::GaussianBlur(gray_img, blurred_gray_img, cv::Size(kernel_size_V, kernel_size_V), kernel_size_V);
-		}
-		else {
-			blurred_gray_img = gray_img.clone();
-		}
-
-		// compute Ver and Hor
-		cv::Mat_<float> Ver, Hor;
-		computeVerAndHor2(blurred_gray_img, Ver, Hor, 0.0);
+		FacadeAnalysis analysis(img, average_floor_height, average_column_width);
+		subdivideFacade(analysis, align_windows, y_splits, x_splits, win_rects);
+	}
 
-		// smooth Ver and Hor
-		if (kernel_size_V > 1) {
-			cv::blur(Ver, Ver, cv::Size(kernel_size_V, kernel_size_V));
-		}
-		if (kernel_size_H > 1) {
-			cv::blur(Hor, Hor, cv::Size(kernel_size_H, kernel_size_H));
-		}
+	/**
+	 * Subdivide the facade using the intermediates of the analysis context.
+	 * The intermediates computed here (gray image, blurred image, Ver/Hor, gradient integral) remain in the context,
+	 * so that the caller can reuse them for the visualization.
+	 */
+	void subdivideFacade(FacadeAnalysis& analysis, bool align_windows, std::vector<float>& y_splits, std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, const WindowOptions& options, TileStats* stats) {
+		const cv::Mat& img = analysis.image();
+		float average_floor_height = analysis.floorHeight();
+		float average_column_width = analysis.columnWidth();
+
+		// blurred gray image, Ver and Hor
+		const cv::Mat& blurred_gray_img = analysis.blurredGrayImage();
+		const cv::Mat_<float>& Ver = analysis.ver();
+		const cv::Mat_<float>& Hor = analysis.hor();
 		
 		////////////////////////////////////////////////////////////////////////////////////////////////
 		// subdivide vertically
@@ -55,181 +49,295 @@ namespace fs {
 		cv::Range w_range2 = cv::Range(average_column_width * 0.3, average_column_width * 1.95);
 		x_splits = findBoundaries(blurred_gray_img.t(), w_range1, w_range2, std::round(img.cols / average_column_width) + 1, Hor);
 		
-		extractWindows(gray_img, y_splits, x_splits, win_rects);
-	}
-
-	std::vector<float> findBoundaries(const cv::Mat& img, cv::Range range1, cv::Range range2, int num_splits, const cv::Mat_<float>& Ver) {
-		std::vector<std::vector<float>> good_candidates;
+		extractWindows(analysis, y_splits, x_splits, win_rects, options, stats);
 
-		// find the local minima of Ver
-		std::vector<float> y_splits_strong;
-		getSplitLines(Ver, 0.5, y_splits_strong);
-
-		// ignore the split lines that are too close to the border
-		if (y_splits_strong.size() > 0 && y_splits_strong[0] < range2.start) {
-			y_splits_strong.erase(y_splits_strong.begin());
-		}
-		if (y_splits_strong.size() > 0 && img.rows - 1 - y_splits_strong.back() < range2.start) {
-			y_splits_strong.pop_back();
+		// snap the sides of the windows to the edges
+		if (options.refinement.enabled) {
+			refineWindows(analysis.edgeIntegral(), y_splits, x_splits, win_rects, options.refinement.max_iter, options.refinement.lambda, options.refinement.radius);
 		}
+	}
 
-		for (int iter = 0; iter < 2; ++iter) {
-			// find the local minima of Ver
-			std::vector<float> y_splits;
-			getSplitLines(Ver, 0.05 / (iter + 1), y_splits);
+	/**
+	* 階の高さと列の幅を画像から推定して、Facadeを分割する。
+	* h、wの探索範囲は、推定した周期を中心に設定される。
+	*
+	* @param img				Facade画像 (3-channel color image)
+	* @param align_windows		true if the windows are aligned
+	* @param y_splits			y coordinates of the floor boundaries
+	* @param x_splits			x coordinates of the column boundaries
+	* @param win_rects			windows of each tile
+	*/
+	void subdivideFacade(cv::Mat img, bool align_windows, std::vector<float>& y_splits, std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects) {
+		float average_floor_height, average_column_width;
+		estimateFloorHeightAndColumnWidth(img, average_floor_height, average_column_width);
+		subdivideFacade(img, average_floor_height, average_column_width, align_windows, y_splits, x_splits, win_rects);
+	}
 
-			// check whether each split is strong or not
-			std::map<float, bool> is_strong;
-			for (int i = 0; i < y_splits.size(); ++i) {
-				if (std::find(y_splits_strong.begin(), y_splits_strong.end(), y_splits[i]) != y_splits_strong.end()) {
-					is_strong[y_splits[i]] = true;
-				}
-				else {
-					is_strong[y_splits[i]] = false;
+	/**
+	* findBoundariesのための、候補のsplit linesを選ぶ動的計画法。
+	* pathは0から始まり、候補を昇順にたどって、rows - 1で終わる。
+	* 状態は (候補, それまでのsplit数, それまでにスキップしたstrong splitの数) で、
+	* 間隔の範囲、split数の許容範囲、strong splitの制約は全て遷移で表される。
+	* 目的関数 avg_Ver * alpha + stddev / avg_h * (1 - alpha) は分解できないが、split数を固定すると
+	* (Verの和, 高さの2乗和) について concave なので、最小値は実行可能なpathの凸包の頂点で達成される。
+	* その頂点を、2つの和の重み付き和を最小化するDPを繰り返して列挙する。
+	*/
+	class BoundarySelector {
+	private:
+		int rows;
+		int num_splits;
+		int max_skips;
+		cv::Range range1;
+		cv::Range range2;
+		std::vector<int> positions;				// 0 and the candidates in ascending order
+		std::vector<float> Ver_values;			// Ver at each node
+		std::vector<int> num_strong_before;		// #strong nodes before each node
+		std::vector<int> edge_begin;			// edges[edge_begin[v], edge_begin[v + 1]) are the next nodes of v
+		std::vector<int> edges;
+		std::vector<double> cost;				// DP table over (node, #splits, #skips)
+		std::vector<int> prev;
+
+		struct Path {
+			std::vector<int> nodes;
+			double sum_Ver;
+			double sum_h2;
+		};
+
+	public:
+		BoundarySelector(int rows, const std::vector<float>& y_splits, const std::vector<float>& y_splits_strong, cv::Range range1, cv::Range range2, int num_splits, const cv::Mat_<float>& Ver) : rows(rows), num_splits(num_splits), range1(range1), range2(range2) {
+			int n = y_splits.size() + 1;
+			positions.resize(n);
+			Ver_values.resize(n);
+			num_strong_before.resize(n + 1);
+			positions[0] = 0;
+			Ver_values[0] = 0;
+			for (int i = 1; i < n; ++i) {
+				positions[i] = y_splits[i - 1];
+				Ver_values[i] = Ver(positions[i]);
+			}
+
+			// strong nodes
+			std::vector<unsigned char> strong(n, 0);
+			int num_strong_nodes = 0;
+			num_strong_before[0] = 0;
+			for (int i = 0; i < n; ++i) {
+				if (i > 0 && std::find(y_splits_strong.begin(), y_splits_strong.end(), y_splits[i - 1]) != y_splits_strong.end()) {
+					strong[i] = 1;
+					num_strong_nodes++;
 				}
+				num_strong_before[i + 1] = num_strong_before[i] + strong[i];
 			}
 
-			std::list<std::vector<float>> queue;
-			queue.push_back(std::vector<float>(1, 0));
-			while (!queue.empty()) {
-				std::vector<float> list = queue.back();
-				queue.pop_back();
+			// the candidates that have too few strong splits are discarded,
+			// i.e., at most (#strong nodes - minimum #strong splits) strong nodes can be skipped
+			int min_strong_splits = 0;
+			while ((float)min_strong_splits < y_splits_strong.size() * 0.8) min_strong_splits++;
+			max_skips = num_strong_nodes - min_strong_splits;
+
+			// the next nodes of each node
+			// (the top floor uses the wider range, and a strong split within the range cannot be skipped)
+			edge_begin.resize(n + 1);
+			for (int v = 0; v < n; ++v) {
+				edge_begin[v] = edges.size();
+				const cv::Range& range = v == 0 ? range2 : range1;
+				for (int u = v + 1; u < n; ++u) {
+					int h = positions[u] - positions[v];
+					if (h < range.start) continue;
+					if (h > range.end) break;
+
+					edges.push_back(u);
+					if (strong[u]) break;
+				}
+			}
+			edge_begin[n] = edges.size();
+		}
 
-				if (img.rows - list.back() >= range2.start && img.rows - list.back() <= range2.end) {
-					std::vector<float> new_list = list;
-					new_list.push_back(img.rows - 1);
+		/**
+		* 最適なsplit linesを返す。
+		*
+		* @param y_splits		[OUT] split lines including 0 and rows - 1
+		* @return				false if there is no candidate
+		*/
+		bool select(std::vector<float>& y_splits) {
+			if (max_skips < 0) return false;
 
-					// Only if the number of splits so far does not exceed the limit,
-					// add this to the candidate list.
-					if (std::abs((int)new_list.size() - num_splits) <= 1) {
-						good_candidates.push_back(new_list);
+			float min_val = std::numeric_limits<float>::max();
+			bool found = false;
+			float alpha = 0.5;
+			for (int m = std::max(1, num_splits - 2); m <= num_splits; ++m) {
+				// vertices of the convex hull of (sum of Ver, sum of squared heights) of the paths of m floors
+				std::vector<Path> vertices(2);
+				if (!solve(m, 1, 0, vertices[0])) continue;
+				solve(m, 0, 1, vertices[1]);
+				walkHull(m, vertices[0], vertices[1], vertices);
+
+				for (int i = 0; i < vertices.size(); ++i) {
+					const std::vector<int>& nodes = vertices[i].nodes;
+
+					// compute the average Ver/Hor
+					float total_Ver = 0;
+					for (int k = 1; k < (int)nodes.size(); ++k) {
+						total_Ver += Ver_values[nodes[k]];
 					}
-				}
+					float avg_Ver = total_Ver / ((int)nodes.size() - 1);
 
-				for (int i = 0; i < y_splits.size(); ++i) {
-					if (y_splits[i] <= list.back()) continue;
-					if (list.size() == 1) {
-						// for the top floor, use the wider range to check
-						if (y_splits[i] - list.back() < range2.start || y_splits[i] - list.back() > range2.end) continue;
+					// compute stddev of heights
+					std::vector<float> heights;
+					for (int k = 0; k < (int)nodes.size(); ++k) {
+						int h = (k + 1 < nodes.size() ? positions[nodes[k + 1]] : rows - 1) - positions[nodes[k]];
+						heights.push_back(h);
 					}
-					else {
-						// for other floors, use the narrower range to check
-						if (y_splits[i] - list.back() < range1.start || y_splits[i] - list.back() > range1.end) continue;
-					}
-
-					std::vector<float> new_list = list;
-					new_list.push_back(y_splits[i]);
-
-					// Only if the number of splits so far does not exceed the limit,
-					// add this to the queue.
-					if ((int)new_list.size() + 1 - num_splits <= 1) {
-						queue.push_back(new_list);
+					float stddev = utils::stddev(heights);
+					if (heights.size() > 0) {
+						float avg_h = utils::mean(heights);
+						stddev /= avg_h;
 					}
 
-					// If this split is a strong one, you cannot skip this, so stop here.
-					if (is_strong[y_splits[i]]) {
-						break;
+					// the first candidate is kept even if its value is undefined (no split except the both ends)
+					float val = avg_Ver * alpha + stddev * (1 - alpha);
+					if (val < min_val || !found) {
+						if (val < min_val) min_val = val;
+						found = true;
+						y_splits.clear();
+						for (int k = 0; k < nodes.size(); ++k) {
+							y_splits.push_back(positions[nodes[k]]);
+						}
+						y_splits.push_back(rows - 1);
 					}
 				}
-
 			}
 
-			// discard the candidates that have too few strong splits
-			for (int i = 0; i < good_candidates.size(); ) {
-				int num_strong_splits = 0;
-				for (int j = 0; j < good_candidates[i].size(); ++j) {
-					if (is_strong[good_candidates[i][j]]) num_strong_splits++;
-				}
+			return found;
+		}
 
-				if ((float)num_strong_splits < y_splits_strong.size() * 0.8) {
-					good_candidates.erase(good_candidates.begin() + i);
-				}
-				else {
-					++i;
+	private:
+		int stateIndex(int v, int c, int s) const {
+			return (v * (num_splits + 1) + c) * (max_skips + 1) + s;
+		}
+
+		/**
+		* m個のfloorから成るpathのうち、w_Ver * (Verの和) + w_h2 * (高さの2乗和) を最小化するものを求める。
+		*/
+		bool solve(int m, double w_Ver, double w_h2, Path& path) {
+			int n = positions.size();
+			cost.assign(n * (num_splits + 1) * (max_skips + 1), std::numeric_limits<double>::infinity());
+			prev.assign(cost.size(), -1);
+			cost[stateIndex(0, 1, 0)] = 0;
+
+			double best_cost = std::numeric_limits<double>::infinity();
+			int best_state = -1;
+			for (int v = 0; v < n; ++v) {
+				int skips_after = num_strong_before[n] - num_strong_before[v + 1];
+				int h_end = rows - 1 - positions[v];
+				bool can_end = rows - positions[v] >= range2.start && rows - positions[v] <= range2.end;
+
+				for (int c = 1; c <= std::min(m, num_splits); ++c) {
+					for (int s = 0; s <= max_skips; ++s) {
+						int state = stateIndex(v, c, s);
+						if (cost[state] == std::numeric_limits<double>::infinity()) continue;
+
+						// close the path with the bottom boundary
+						if (c == m && can_end && s + skips_after <= max_skips) {
+							double total = cost[state] + w_h2 * h_end * h_end;
+							if (total < best_cost) {
+								best_cost = total;
+								best_state = state;
+							}
+						}
+
+						// the number of splits so far (including the bottom boundary) should not exceed the limit
+						if (c + 1 > m) continue;
+
+						for (int e = edge_begin[v]; e < edge_begin[v + 1]; ++e) {
+							int u = edges[e];
+							int s2 = s + num_strong_before[u] - num_strong_before[v + 1];
+							if (s2 > max_skips) continue;
+
+							int h = positions[u] - positions[v];
+							double new_cost = cost[state] + w_Ver * Ver_values[u] + w_h2 * h * h;
+							int state2 = stateIndex(u, c + 1, s2);
+							if (new_cost < cost[state2]) {
+								cost[state2] = new_cost;
+								prev[state2] = state;
+							}
+						}
+					}
 				}
 			}
 
-			// if there is no good candidate found, increase the range and start over the process
-			if (good_candidates.size() == 0) {
-				continue;
-			}
+			if (best_state < 0) return false;
 
-			// if there is only one option, select it.
-			if (good_candidates.size() == 1) {
-				return good_candidates[0];
+			path.nodes.clear();
+			for (int state = best_state; state >= 0; state = prev[state]) {
+				path.nodes.push_back(state / ((num_splits + 1) * (max_skips + 1)));
+			}
+			std::reverse(path.nodes.begin(), path.nodes.end());
+
+			path.sum_Ver = 0;
+			path.sum_h2 = 0;
+			for (int k = 0; k < path.nodes.size(); ++k) {
+				int h = (k + 1 < path.nodes.size() ? positions[path.nodes[k + 1]] : rows - 1) - positions[path.nodes[k]];
+				if (k > 0) path.sum_Ver += Ver_values[path.nodes[k]];
+				path.sum_h2 += (double)h * h;
 			}
 
-#if 1
-			// find the best candidate
-			float min_val = std::numeric_limits<float>::max();
-			int best_id = -1;
-			float alpha = 0.5;
-			for (int i = 0; i < good_candidates.size(); ++i) {
-				// compute the average Ver/Hor
-				float total_Ver = 0;
-				for (int k = 1; k < (int)good_candidates[i].size() - 1; ++k) {
-					total_Ver += Ver(good_candidates[i][k]);
-				}
+			return true;
+		}
 
-				float avg_Ver = total_Ver / ((int)good_candidates[i].size() - 2);
+		/**
+		* 凸包の頂点p, qの間にある頂点を再帰的に求めて、verticesに追加する。
+		*/
+		void walkHull(int m, Path p, Path q, std::vector<Path>& vertices) {
+			double w_Ver = p.sum_h2 - q.sum_h2;
+			double w_h2 = q.sum_Ver - p.sum_Ver;
+			if (w_Ver <= 0 && w_h2 <= 0) return;
 
-				// compute stddev of heights
-				std::vector<float> heights;
-				for (int k = 0; k < (int)good_candidates[i].size() - 1; ++k) {
-					int h = good_candidates[i][k + 1] - good_candidates[i][k];
-					heights.push_back(h);
-				}
-				float stddev = utils::stddev(heights);
-				if (heights.size() > 0) {
-					float avg_h = utils::mean(heights);
-					stddev /= avg_h;
-				}
+			Path r;
+			solve(m, w_Ver, w_h2, r);
+			double eps = 1e-9 * (std::abs(w_Ver * p.sum_Ver) + std::abs(w_h2 * p.sum_h2));
+			if (w_Ver * r.sum_Ver + w_h2 * r.sum_h2 >= w_Ver * p.sum_Ver + w_h2 * p.sum_h2 - eps) return;
 
-				if (avg_Ver * alpha + stddev * (1 - alpha) < min_val) {
-					min_val = avg_Ver  * alpha + stddev * (1 - alpha);
-					best_id = i;
-				}
-			}
+			vertices.push_back(r);
+			walkHull(m, p, r, vertices);
+			walkHull(m, r, q, vertices);
+		}
+	};
 
-			return good_candidates[best_id];
-#endif
+	std::vector<float> findBoundaries(const cv::Mat& img, cv::Range range1, cv::Range range2, int num_splits, const cv::Mat_<float>& Ver) {
+		// the minima of Ver are found once and queried with different thresholds
+		MinimaHierarchy hierarchy(Ver);
 
-#if 0
-			// compute S
-			float min_S = std::numeric_limits<float>::max();
-			int best_id = -1;
-			for (int i = 0; i < good_candidates.size(); ++i) {
-				float avg_S = 0;
-				if (good_candidates[i].size() >= 3) {
-					float total_S = 0;
-					for (int j = 0; j < good_candidates[i].size() - 2; ++j) {
-						int h1 = good_candidates[i][j + 1] - good_candidates[i][j];
-						int h2 = good_candidates[i][j + 2] - good_candidates[i][j + 1];
-						if (std::abs(h1 - h2) / h1 < 0.1) {
-							cv::Mat roi1(img, cv::Rect(0, good_candidates[i][j], img.cols, h1));
-							cv::Mat roi2(img, cv::Rect(0, good_candidates[i][j + 1], img.cols, h2));
-							total_S += MI(roi1, roi2);
-						}
-					}
+		// find the local minima of Ver
+		std::vector<float> y_splits_strong;
+		getSplitLines(hierarchy, 0.5, y_splits_strong);
 
-					avg_S = total_S / (good_candidates[i].size() - 2);
-				}
+		// ignore the split lines that are too close to the border
+		if (y_splits_strong.size() > 0 && y_splits_strong[0] < range2.start) {
+			y_splits_strong.erase(y_splits_strong.begin());
+		}
+		if (y_splits_strong.size() > 0 && img.rows - 1 - y_splits_strong.back() < range2.start) {
+			y_splits_strong.pop_back();
+		}
 
-				if (avg_S < min_S) {
-					min_S = avg_S;
-					best_id = i;
-				}
-			}
+		for (int iter = 0; iter < 2; ++iter) {
+			// find the local minima of Ver
+			std::vector<float> y_splits;
+			getSplitLines(hierarchy, 0.05 / (iter + 1), y_splits);
 
-			return good_candidates[best_id];
-#endif
+			// select the best candidate by dynamic programming
+			// if there is no good candidate found, increase the range and start over the process
+			BoundarySelector selector(img.rows, y_splits, y_splits_strong, range1, range2, num_splits, Ver);
+			std::vector<float> best_splits;
+			if (selector.select(best_splits)) {
+				return best_splits;
+			}
 		}
 		
 		// if there is no good splits found, use the original candidate splits
 		std::cerr << "-----------------------------------" << std::endl;
 		std::cerr << "No good split is found!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
 		std::vector<float> y_splits;
-		getSplitLines(Ver, 0.1, y_splits);
+		getSplitLines(hierarchy, 0.1, y_splits);
 		y_splits.insert(y_splits.begin(), 0);
 		y_splits.push_back(img.rows - 1);
 
@@ -255,22 +363,68 @@ namespace fs {
 	}
 
 	void extractWindows(cv::Mat gray_img, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects) {
-		// compute gradient magnitude
-		cv::Mat sobelx;
-		cv::Sobel(gray_img, sobelx, CV_32F, 1, 0);
-		cv::multiply(sobelx, sobelx, sobelx);
+		// |Gx| and |Gy| of the whole facade, from which Ver/Hor of each tile are taken
+		GradientIntegral grad(gray_img);
 
-		cv::Mat sobely;
-		cv::Sobel(gray_img, sobely, CV_32F, 0, 1);
-		cv::multiply(sobely, sobely, sobely);
+		// edges of the whole facade, from which the edge projections of each tile are taken
+		cv::Mat edge_img;
+		cv::Canny(gray_img, edge_img, 50, 150);
+		EdgeIntegral edges(edge_img);
 
-		cv::Mat_<float> grad_mag;
-		cv::sqrt(sobelx + sobely, grad_mag);
+		extractWindows(grad, edges, NULL, false, y_splits, x_splits, win_rects);
+	}
+
+	/**
+	 * Extract windows using the gradient integral, the edge integral and the tile classifier of the analysis context.
+	 * If options.group_tiles is true, the window is detected only once per tile type.
+	 * The tile classifier is built only if the blank tiles are skipped or the skips are counted.
+	 */
+	void extractWindows(FacadeAnalysis& analysis, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, const WindowOptions& options, TileStats* stats) {
+		if (options.group_tiles) {
+			const TileClassifier* classifier = options.skip_blank_tiles || stats != NULL ? &analysis.tileClassifier() : NULL;
+			extractWindowsByTileTypes(analysis.grayImage(), analysis.gradientIntegral(), analysis.edgeIntegral(), classifier, y_splits, x_splits, win_rects, options, stats);
+		}
+		else {
+			const TileClassifier* classifier = options.skip_blank_tiles || stats != NULL ? &analysis.tileClassifier() : NULL;
+			extractWindows(analysis.gradientIntegral(), analysis.edgeIntegral(), classifier, options.skip_blank_tiles, y_splits, x_splits, win_rects, stats);
+		}
+	}
+
+	/**
+	* 各tileの窓を求める処理の並列化。
+	* 各work itemはtilesの1つのtileで、結果はwin_rects[i][j]に書くので、順序はスレッド数に依存しない。
+	* 各スレッドは、Ver/Hor、edgeなどのバッファを、担当するtile間で使い回す。
+	* edgeはfacade全体で1回だけ検出し、各tileのedgeの和はEdgeIntegralから取得する。
+	* skipの場合、TileClassifierでblankと判定されたtileは、窓の検出をスキップする。
+	* validateの場合は、blankなtileでも検出を行い、窓が見つかったtileを誤ったスキップとして数える (skipでなければ、検出結果はそのまま残す)。
+	*/
+	class WindowExtraction : public cv::ParallelLoopBody {
+	private:
+		const GradientIntegral& grad;
+		const EdgeIntegral& edges;
+		const TileClassifier* classifier;
+		bool skip;
+		bool validate;
+		const std::vector<int>& tiles;
+		const std::vector<float>& y_splits;
+		const std::vector<float>& x_splits;
+		std::vector<std::vector<WindowPos>>& win_rects;
+		std::vector<unsigned char>& skipped;
+		std::vector<unsigned char>& false_skips;
+
+	public:
+		WindowExtraction(const GradientIntegral& grad, const EdgeIntegral& edges, const TileClassifier* classifier, bool skip, bool validate, const std::vector<int>& tiles, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, std::vector<unsigned char>& skipped, std::vector<unsigned char>& false_skips) : grad(grad), edges(edges), classifier(classifier), skip(skip), validate(validate), tiles(tiles), y_splits(y_splits), x_splits(x_splits), win_rects(win_rects), skipped(skipped), false_skips(false_skips) {}
+
+		void operator()(const cv::Range& range) const {
+			// scratch buffers reused across the tiles
+			cv::Mat_<float> Ver, Hor;
+			cv::Mat_<float> edgeV, edgeH;
+
+			for (int item = range.start; item < range.end; ++item) {
+				int tile = tiles[item];
+				int i = tile / (x_splits.size() - 1);
+				int j = tile % (x_splits.size() - 1);
 
-		win_rects.resize(y_splits.size() - 1);
-		for (int i = 0; i < y_splits.size() - 1; ++i) {
-			win_rects[i].resize(x_splits.size() - 1);
-			for (int j = 0; j < x_splits.size() - 1; ++j) {
 				int x1 = x_splits[j];
 				int x2 = x_splits[j + 1] - 1;
 				int y1 = y_splits[i];
@@ -281,13 +435,19 @@ namespace fs {
 				int min_w = w * 0.1;
 				int min_h = h * 0.1;
 
-				// tile image
-				cv::Mat tile_img(gray_img, cv::Rect(x1, y1, w, h));
+				// skip the tile that has no structure
+				bool blank = classifier != NULL && classifier->isBlank(cv::Rect(x1, y1, w, h));
+				if (blank) {
+					skipped[tile] = 1;
+					if (skip && !validate) {
+						win_rects[i][j] = WindowPos();
+						continue;
+					}
+				}
 
 				// Update: 2016/12/07
 				// use Ver/Hor of this tile instead of the global ones
-				cv::Mat_<float> Ver, Hor;
-				computeVerAndHor2(tile_img, Ver, Hor, 0.0);
+				computeVerAndHor2(grad, cv::Rect(x1, y1, w, h), Ver, Hor, 0.0);
 
 
 				// compute max/min of Ver/Hor
@@ -314,20 +474,8 @@ namespace fs {
 				float left_threshold_Hor = (max_Hor - left_Hor) * 0.2 + left_Hor;
 				float right_threshold_Hor = (max_Hor - right_Hor) * 0.2 + right_Hor;
 
-				// defind a threshold
-				float threshold1 = 50;
-				float threshold2 = 150;
-
-				// detect edge
-				//cv::Mat roi(gray_img, cv::Rect(x1, y1, w, h));
-				cv::Mat edges;
-				cv::Canny(tile_img, edges, threshold1, threshold2);
-				
 				// sum up edge horizontally and vertically
-				cv::Mat edgeV, edgeH;
-				cv::reduce(edges, edgeV, 1, cv::REDUCE_SUM, CV_32F);
-				cv::reduce(edges, edgeH, 0, cv::REDUCE_SUM, CV_32F);
-				edgeH = edgeH.t();
+				edges.project(cv::Rect(x1, y1, w, h), edgeV, edgeH);
 
 
 
@@ -340,7 +488,7 @@ namespace fs {
 						if (Hor(xx) < left_threshold_Hor) continue;
 						flag = true;
 					}
-					if (edgeH.at<float>(xx, 0) >= 255 * h * 0.1) {
+					if (edgeH.at<float>(0, xx) >= 255 * h * 0.1) {
 						left = xx;
 						break;
 					}
@@ -354,7 +502,7 @@ namespace fs {
 						if (Hor(xx) < right_threshold_Hor) continue;
 						flag = true;
 					}
-					if (edgeH.at<float>(xx, 0) >= 255 * h * 0.1) {
+					if (edgeH.at<float>(0, xx) >= 255 * h * 0.1) {
 						right = xx;
 						break;
 					}
@@ -394,10 +542,317 @@ namespace fs {
 				else {
 					win_rects[i][j].valid = WindowPos::INVALID;
 				}
+
+				// the skipped tile stays invalid even if the detector finds a window in it
+				if (blank) {
+					if (win_rects[i][j].valid == WindowPos::VALID) false_skips[tile] = 1;
+					if (skip) win_rects[i][j] = WindowPos();
+				}
+			}
+		}
+	};
+
+	/**
+	 * Extract windows of the tiles.
+	 *
+	 * @param grad			gradient integral of the facade
+	 * @param edges			edge integral of the facade
+	 * @param classifier	tile classifier (NULL: no tile is classified)
+	 * @param skip_blank_tiles	true if the detection is skipped on the blank tiles (false: the blank tiles are only counted)
+	 * @param y_splits		y coordinates of the floor boundaries
+	 * @param x_splits		x coordinates of the column boundaries
+	 * @param win_rects		[OUT] windows of each tile
+	 * @param stats			[OUT] number of blank tiles (if given, the detector is run also on the blank tiles to count the false skips)
+	 */
+	void extractWindows(const GradientIntegral& grad, const EdgeIntegral& edges, const TileClassifier* classifier, bool skip_blank_tiles, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, TileStats* stats) {
+		win_rects.resize(y_splits.size() - 1);
+		for (int i = 0; i < y_splits.size() - 1; ++i) {
+			win_rects[i].resize(x_splits.size() - 1);
+		}
+
+		// several stripes per thread so that the threads that finish early take over the remaining tiles
+		int num_tiles = (y_splits.size() - 1) * (x_splits.size() - 1);
+		std::vector<int> tiles(num_tiles);
+		for (int i = 0; i < num_tiles; ++i) tiles[i] = i;
+		std::vector<unsigned char> skipped(num_tiles, 0);
+		std::vector<unsigned char> false_skips(num_tiles, 0);
+		cv::parallel_for_(cv::Range(0, num_tiles), WindowExtraction(grad, edges, classifier, skip_blank_tiles, stats != NULL, tiles, y_splits, x_splits, win_rects, skipped, false_skips), cv::getNumThreads() * 4);
+
+		if (stats != NULL) {
+			stats->num_tiles += num_tiles;
+			for (int i = 0; i < num_tiles; ++i) {
+				stats->num_skipped += skipped[i];
+				stats->num_false_skips += false_skips[i];
+				stats->num_detections += skip_blank_tiles ? 1 - skipped[i] : 1;
+			}
+		}
+	}
+
+	/**
+	 * Extract windows by exploiting the repetition of the facade.
+	 * The tiles (except the blank ones if options.skip_blank_tiles) are grouped into types by comparing their downsampled images,
+	 * and the detector is run only on the representative of each type.
+	 * The window of the representative is scaled to the size of each other tile of the type,
+	 * and each side of it is snapped to the strongest edge nearby.
+	 *
+	 * @param gray_img		gray image of the facade
+	 * @param grad			gradient integral of the facade
+	 * @param edges			edge integral of the facade
+	 * @param classifier	tile classifier for finding the blank tiles (NULL: no tile is blank)
+	 * @param y_splits		y coordinates of the floor boundaries
+	 * @param x_splits		x coordinates of the column boundaries
+	 * @param win_rects		[OUT] windows of each tile
+	 * @param options		options of the grouping and the refinement (the blank tiles are skipped only if options.skip_blank_tiles)
+	 * @param stats			[OUT] number of blank tiles and detector runs (if given, the detector is run also on the blank tiles to count the false skips)
+	 */
+	void extractWindowsByTileTypes(const cv::Mat& gray_img, const GradientIntegral& grad, const EdgeIntegral& edges, const TileClassifier* classifier, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, const WindowOptions& options, TileStats* stats) {
+		int num_cols = x_splits.size() - 1;
+		win_rects.resize(y_splits.size() - 1);
+		for (int i = 0; i < y_splits.size() - 1; ++i) {
+			win_rects[i].resize(num_cols);
+		}
+
+		int num_tiles = (y_splits.size() - 1) * num_cols;
+		std::vector<cv::Rect> rects(num_tiles);
+		std::vector<unsigned char> blank(num_tiles, 0);
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			int i = tile / num_cols;
+			int j = tile % num_cols;
+			int x1 = x_splits[j];
+			int x2 = x_splits[j + 1] - 1;
+			int y1 = y_splits[i];
+			int y2 = y_splits[i + 1] - 1;
+			rects[tile] = cv::Rect(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+			if (classifier != NULL && classifier->isBlank(rects[tile])) blank[tile] = 1;
+		}
+
+		// the blank tiles are excluded from the grouping only if they are skipped
+		std::vector<unsigned char> excluded(num_tiles, 0);
+		if (options.skip_blank_tiles) excluded = blank;
+
+		std::vector<int> types;
+		std::vector<int> representatives;
+		groupTiles(gray_img, y_splits, x_splits, excluded, options.max_tile_distance, options.descriptor_size, types, representatives);
+
+		// the detector runs on the representatives (and on the other blank tiles only to count the false skips)
+		std::vector<int> tiles = representatives;
+		if (stats != NULL) {
+			for (int tile = 0; tile < num_tiles; ++tile) {
+				if (blank[tile] && (excluded[tile] || representatives[types[tile]] != tile)) tiles.push_back(tile);
+			}
+		}
+		std::vector<unsigned char> skipped(num_tiles, 0);
+		std::vector<unsigned char> false_skips(num_tiles, 0);
+		cv::parallel_for_(cv::Range(0, tiles.size()), WindowExtraction(grad, edges, classifier, options.skip_blank_tiles, stats != NULL, tiles, y_splits, x_splits, win_rects, skipped, false_skips), cv::getNumThreads() * 4);
+
+		// map the windows of the representatives to the other tiles
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			int i = tile / num_cols;
+			int j = tile % num_cols;
+			if (excluded[tile]) {
+				win_rects[i][j] = WindowPos();
+				continue;
+			}
+
+			int rep = representatives[types[tile]];
+			if (rep == tile) continue;
+			win_rects[i][j] = mapWindow(win_rects[rep / num_cols][rep % num_cols], rects[rep], rects[tile], edges, options.refine_radius);
+		}
+
+		if (stats != NULL) {
+			stats->num_tiles += num_tiles;
+			stats->num_detections += representatives.size();
+			for (int i = 0; i < num_tiles; ++i) {
+				stats->num_skipped += blank[i];
+				stats->num_false_skips += false_skips[i];
+			}
+		}
+	}
+
+	/**
+	 * Group the tiles into types.
+	 * Each tile is downsampled to descriptor_size x descriptor_size, and normalized to zero mean and unit norm,
+	 * so that the distance 1 - (correlation) does not depend on the size or the brightness of the tile.
+	 * The tiles are visited in the raster order, and each tile joins the type whose first tile is the closest
+	 * if the distance is less than max_distance, or starts a new type otherwise.
+	 * The representative of each type is the tile closest to the mean descriptor of the type.
+	 *
+	 * @param gray_img			gray image of the facade
+	 * @param y_splits			y coordinates of the floor boundaries
+	 * @param x_splits			x coordinates of the column boundaries
+	 * @param excluded			tiles that are not grouped (e.g. blank tiles)
+	 * @param max_distance		maximum distance to the first tile of the type
+	 * @param descriptor_size	size of the downsampled tile
+	 * @param types				[OUT] type of each tile (-1 for the excluded tiles)
+	 * @param representatives	[OUT] representative tile of each type
+	 */
+	void groupTiles(const cv::Mat& gray_img, const std::vector<float>& y_splits, const std::vector<float>& x_splits, const std::vector<unsigned char>& excluded, float max_distance, int descriptor_size, std::vector<int>& types, std::vector<int>& representatives) {
+		int num_cols = x_splits.size() - 1;
+		int num_tiles = (y_splits.size() - 1) * num_cols;
+		int dim = descriptor_size * descriptor_size;
+
+		// descriptors of the tiles (flat tiles have no descriptor)
+		cv::Mat_<float> descriptors = cv::Mat_<float>::zeros(num_tiles, dim);
+		std::vector<unsigned char> flat(num_tiles, 0);
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			if (excluded[tile]) continue;
+
+			int i = tile / num_cols;
+			int j = tile % num_cols;
+			int x1 = x_splits[j];
+			int x2 = x_splits[j + 1] - 1;
+			int y1 = y_splits[i];
+			int y2 = y_splits[i + 1] - 1;
+			if (x2 < x1 || y2 < y1) {
+				flat[tile] = 1;
+				continue;
+			}
+
+			cv::Mat small_tile;
+			cv::resize(gray_img(cv::Rect(x1, y1, x2 - x1 + 1, y2 - y1 + 1)), small_tile, cv::Size(descriptor_size, descriptor_size), 0, 0, cv::INTER_AREA);
+			cv::Mat_<float> desc = descriptors.row(tile);
+			small_tile.reshape(1, 1).convertTo(desc, CV_32F);
+			desc -= cv::mean(desc)[0];
+			double norm = cv::norm(desc);
+			if (norm < 1e-3) {
+				desc.setTo(0);
+				flat[tile] = 1;
+			}
+			else {
+				desc /= norm;
+			}
+		}
+
+		// leader clustering in the raster order
+		types.assign(num_tiles, -1);
+		std::vector<int> leaders;
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			if (excluded[tile]) continue;
+
+			int best_type = -1;
+			float best_dist = max_distance;
+			for (int t = 0; t < leaders.size(); ++t) {
+				float dist;
+				if (flat[tile] || flat[leaders[t]]) {
+					dist = flat[tile] && flat[leaders[t]] ? 0.0f : 1.0f;
+				}
+				else {
+					dist = 1.0f - descriptors.row(tile).dot(descriptors.row(leaders[t]));
+				}
+				if (dist < best_dist) {
+					best_dist = dist;
+					best_type = t;
+				}
+			}
+
+			if (best_type < 0) {
+				best_type = leaders.size();
+				leaders.push_back(tile);
+			}
+			types[tile] = best_type;
+		}
+
+		// the representative is the member closest to the mean of the type
+		cv::Mat_<float> means = cv::Mat_<float>::zeros(leaders.size(), dim);
+		std::vector<int> counts(leaders.size(), 0);
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			if (types[tile] < 0) continue;
+			means.row(types[tile]) += descriptors.row(tile);
+			counts[types[tile]]++;
+		}
+		representatives = leaders;
+		std::vector<float> best_dists(leaders.size(), std::numeric_limits<float>::max());
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			int t = types[tile];
+			if (t < 0) continue;
+			float dist = cv::norm(descriptors.row(tile) - means.row(t) / counts[t], cv::NORM_L2SQR);
+			if (dist < best_dists[t]) {
+				best_dists[t] = dist;
+				representatives[t] = tile;
 			}
 		}
 	}
 
+	/**
+	 * Return the position in [lo, hi] within +/- radius of pos, whose column has the most edges in the rows [r1, r2).
+	 * The closest position to pos wins the tie.
+	 */
+	static int snapToColumnEdge(const EdgeIntegral& edges, int pos, int lo, int hi, int r1, int r2, int radius) {
+		int best = pos;
+		int best_count = edges.countCol(pos, r1, r2);
+		for (int d = 1; d <= radius; ++d) {
+			for (int s = -1; s <= 1; s += 2) {
+				int p = pos + s * d;
+				if (p < lo || p > hi) continue;
+				int count = edges.countCol(p, r1, r2);
+				if (count > best_count) {
+					best_count = count;
+					best = p;
+				}
+			}
+		}
+		return best;
+	}
+
+	/**
+	 * Return the position in [lo, hi] within +/- radius of pos, whose row has the most edges in the columns [c1, c2).
+	 * The closest position to pos wins the tie.
+	 */
+	static int snapToRowEdge(const EdgeIntegral& edges, int pos, int lo, int hi, int c1, int c2, int radius) {
+		int best = pos;
+		int best_count = edges.countRow(pos, c1, c2);
+		for (int d = 1; d <= radius; ++d) {
+			for (int s = -1; s <= 1; s += 2) {
+				int p = pos + s * d;
+				if (p < lo || p > hi) continue;
+				int count = edges.countRow(p, c1, c2);
+				if (count > best_count) {
+					best_count = count;
+					best = p;
+				}
+			}
+		}
+		return best;
+	}
+
+	/**
+	 * Map the window of a tile to another tile of the same type.
+	 * The window is scaled to the size of the target tile, and each side is snapped to the strongest edge within +/- radius pixels.
+	 *
+	 * @param winpos		window of the source tile (relative to the tile)
+	 * @param from			source tile
+	 * @param to			target tile
+	 * @param edges			edge integral of the facade
+	 * @param radius		search radius of the refinement
+	 * @return				window of the target tile (relative to the tile)
+	 */
+	WindowPos mapWindow(const WindowPos& winpos, const cv::Rect& from, const cv::Rect& to, const EdgeIntegral& edges, int radius) {
+		if (winpos.valid != WindowPos::VALID || from.width <= 0 || from.height <= 0 || to.width <= 0 || to.height <= 0) return WindowPos();
+
+		float sx = (float)to.width / from.width;
+		float sy = (float)to.height / from.height;
+		int left = std::min(std::max(cvRound(winpos.left * sx), 0), to.width - 1);
+		int right = std::min(std::max(cvRound(winpos.right * sx), left), to.width - 1);
+		int top = std::min(std::max(cvRound(winpos.top * sy), 0), to.height - 1);
+		int bottom = std::min(std::max(cvRound(winpos.bottom * sy), top), to.height - 1);
+
+		// snap each side to the edge along the side of the scaled window
+		int new_left = snapToColumnEdge(edges, to.x + left, to.x, to.x + right, to.y + top, to.y + bottom + 1, radius) - to.x;
+		int new_right = snapToColumnEdge(edges, to.x + right, to.x + left, to.x + to.width - 1, to.y + top, to.y + bottom + 1, radius) - to.x;
+		int new_top = snapToRowEdge(edges, to.y + top, to.y, to.y + bottom, to.x + left, to.x + right + 1, radius) - to.y;
+		int new_bottom = snapToRowEdge(edges, to.y + bottom, to.y + top, to.y + to.height - 1, to.x + left, to.x + right + 1, radius) - to.y;
+		if (new_left < new_right) {
+			left = new_left;
+			right = new_right;
+		}
+		if (new_top < new_bottom) {
+			top = new_top;
+			bottom = new_bottom;
+		}
+
+		return WindowPos(left, top, right, bottom);
+	}
+
 	/**
 	* 2つの領域の類似度を返却する。
 	*
@@ -407,52 +862,11 @@ namespace fs {
 	*/
 	float MI(const cv::Mat& R1, const cv::Mat& R2) {
 #if 1
-		cv::Mat_<float> Pab(256, 256, 0.0f);
-		cv::Mat_<float> Pa(256, 1, 0.0f);
-		cv::Mat_<float> Pb(256, 1, 0.0f);
-
 		// create a histogram of intensities
-		for (int r = 0; r < R1.rows; ++r) {
-			for (int c = 0; c < R1.cols; ++c) {
-				int a = R1.at<unsigned char>(r, c);
-				int b = R2.at<unsigned char>(r, c);
-
-				Pab(a, b)++;
-				Pa(a, 0)++;
-				Pb(b, 0)++;
-			}
-		}
-
-		// normalize the historgram
-		cv::Mat Pab_max;
-		cv::Mat Pa_max;
-		cv::Mat Pb_max;
-		cv::reduce(Pab, Pab_max, 0, CV_REDUCE_SUM);
-		cv::reduce(Pab_max, Pab_max, 1, CV_REDUCE_SUM);
-		cv::reduce(Pa, Pa_max, 0, CV_REDUCE_SUM);
-		cv::reduce(Pb, Pb_max, 0, CV_REDUCE_SUM);
-		Pab /= Pab_max.at<float>(0, 0);
-		Pa /= Pa_max.at<float>(0, 0);
-		Pb /= Pb_max.at<float>(0, 0);
-
-		float result = 0.0f;
-		for (int a = 0; a < 256; ++a) {
-			for (int b = 0; b < 256; ++b) {
-				float v = Pab(a, b);
-				if (v == 0) {
-					v = 0.001f * 0.001f;
-				}
-				float v1 = Pa(a, 0);
-				if (v1 == 0) v1 = 0.001f;
-				float v2 = Pb(b, 0);
-				if (v2 == 0) v2 = 0.001f;
+		JointHistogram hist;
+		hist.addRows(R1.data, R1.step, R2.data, R2.step, R1.rows, R1.cols);
 
-				float hoge = Pab(a, b) * log(v / v1 / v2);
-				result += Pab(a, b) * log(v / v1 / v2);
-			}
-		}
-
-		return result;
+		return hist.MI();
 #endif
 #if 0
 		cv::Mat norm_R1;
@@ -462,6 +876,290 @@ namespace fs {
 #endif
 	}
 
+	/**
+	* 画像内の2つの領域の類似度を返却する。
+	* marginal histogramは、画像全体のIntegralHistogramから取得する。
+	*
+	* @param img				image (1-channel image)
+	* @param integral_hist		integral histogram of img (256 bins)
+	* @param rect1				領域1
+	* @param rect2				領域2
+	* @return					類似度
+	*/
+	float MI(const cv::Mat& img, const IntegralHistogram& integral_hist, const cv::Rect& rect1, const cv::Rect& rect2) {
+		JointHistogram hist(integral_hist.numBins(), false);
+		hist.addRows(img.ptr<unsigned char>(rect1.y) + rect1.x, img.step, img.ptr<unsigned char>(rect2.y) + rect2.x, img.step, rect1.height, rect1.width);
+
+		std::vector<int> Pa(integral_hist.numBins());
+		std::vector<int> Pb(integral_hist.numBins());
+		integral_hist.histogram(rect1, &Pa[0]);
+		integral_hist.histogram(rect2, &Pb[0]);
+
+		return hist.MI(&Pa[0], &Pb[0]);
+	}
+
+	/**
+	* S_max(y)を計算するためのsweepの並列処理。
+	* 各work itemは (h, r_start, r_end) で、[r, r+h)と[r-h, r)の窓を r_start から r_end まで1行ずつスライドさせる。
+	* 各スレッドは自分のJointHistogramとmarginal histogramのバッファを使い回す。
+	* marginal histogramは、IntegralHistogramから取得する。
+	* maskが与えられた場合は、maskが0の (h, r) をスキップし、スキップした行が長ければ (2行のスライド x 行数 > h) histogramを作り直す。
+	*/
+	class SymmetrySweep : public cv::ParallelLoopBody {
+	private:
+		const cv::Mat& img;
+		const IntegralHistogram& integral_hist;
+		const std::vector<cv::Vec3i>& items;
+		int h_start;
+		const SymmetryOptions& options;
+		const cv::Mat_<unsigned char>* mask;
+		cv::Mat_<float>& SV;
+
+	public:
+		SymmetrySweep(const cv::Mat& img, const IntegralHistogram& integral_hist, const std::vector<cv::Vec3i>& items, int h_start, const SymmetryOptions& options, const cv::Mat_<unsigned char>* mask, cv::Mat_<float>& SV) : img(img), integral_hist(integral_hist), items(items), h_start(h_start), options(options), mask(mask), SV(SV) {}
+
+		void operator()(const cv::Range& range) const {
+			JointHistogram hist(options.bins, false);
+			std::vector<int> Pa(options.bins);
+			std::vector<int> Pb(options.bins);
+
+			for (int i = range.start; i < range.end; ++i) {
+				int h = items[i][0];
+				int r_start = items[i][1];
+				int r_end = items[i][2];
+
+				// the row at which the histogram has been built (-1: not built yet)
+				int r_hist = -1;
+				for (int r = r_start; r < r_end; ++r) {
+					if (mask != NULL && !(*mask)(h - h_start, r)) continue;
+
+					if (r_hist < 0 || (r - r_hist) * 2 > h) {
+						hist.clear();
+						hist.addRows(img.ptr<unsigned char>(r), img.step, img.ptr<unsigned char>(r - h), img.step, h, img.cols);
+					}
+					else {
+						for (; r_hist < r; ++r_hist) {
+							hist.remove(img.ptr<unsigned char>(r_hist), img.ptr<unsigned char>(r_hist - h), img.cols);
+							hist.add(img.ptr<unsigned char>(r_hist + h), img.ptr<unsigned char>(r_hist), img.cols);
+						}
+					}
+					r_hist = r;
+
+					integral_hist.rowBand(r, r + h, &Pa[0]);
+					integral_hist.rowBand(r - h, r, &Pb[0]);
+					SV(h - h_start, r) = options.exact ? hist.MI(&Pa[0], &Pb[0]) : hist.fastMI(&Pa[0], &Pb[0]);
+				}
+			}
+		}
+	};
+
+	// MIの浮動小数点の誤差を見込んで、上限にこれを足してから比較する
+	const float PRUNE_SLACK = 1e-4f;
+
+	/**
+	* S_max(y)を計算するための、枝刈り付きのsweepの並列処理。
+	* 各work itemは (r_start, r_end) の行のblockで、そのblock内の各rについて、hを昇順に調べる。
+	* MI(R1, R2) <= min(H(R1), H(R2)) なので、この上限がそれまでのS_max(r)を超えない (r, h) はjoint histogramを作らずにスキップする。
+	* スキップした行が短ければ窓をスライドさせ、長ければ (2行のスライド x 行数 > h) histogramを作り直す。
+	* 各blockは自分の行のS_max、h_maxだけを書くので、結果はスレッド数に依存しない。
+	*/
+	class PrunedSymmetrySweep : public cv::ParallelLoopBody {
+	private:
+		const cv::Mat& img;
+		const IntegralHistogram& integral_hist;
+		const std::vector<cv::Vec2i>& items;
+		int h_start;
+		int h_end;
+		const SymmetryOptions& options;
+		cv::Mat_<float>& SV_max;
+		cv::Mat_<int>& h_max;
+		std::vector<long long>& num_pruned;
+
+	public:
+		PrunedSymmetrySweep(const cv::Mat& img, const IntegralHistogram& integral_hist, const std::vector<cv::Vec2i>& items, int h_start, int h_end, const SymmetryOptions& options, cv::Mat_<float>& SV_max, cv::Mat_<int>& h_max, std::vector<long long>& num_pruned) : img(img), integral_hist(integral_hist), items(items), h_start(h_start), h_end(h_end), options(options), SV_max(SV_max), h_max(h_max), num_pruned(num_pruned) {}
+
+		void operator()(const cv::Range& range) const {
+			JointHistogram hist(options.bins, false);
+			std::vector<int> Pa(options.bins);
+			std::vector<int> Pb(options.bins);
+
+			for (int i = range.start; i < range.end; ++i) {
+				for (int h = h_start; h <= h_end; ++h) {
+					int r_start = std::max(items[i][0], h);
+					int r_end = std::min(items[i][1], img.rows - h);
+
+					// the row at which the histogram has been built (-1: not built yet)
+					int r_hist = -1;
+					for (int r = r_start; r < r_end; ++r) {
+						integral_hist.rowBand(r, r + h, &Pa[0]);
+						integral_hist.rowBand(r - h, r, &Pb[0]);
+						float bound = std::min(hist.entropy(&Pa[0], h * img.cols), hist.entropy(&Pb[0], h * img.cols));
+						if (bound + PRUNE_SLACK <= SV_max(r)) {
+							num_pruned[i]++;
+							continue;
+						}
+
+						if (r_hist < 0 || (r - r_hist) * 2 > h) {
+							hist.clear();
+							hist.addRows(img.ptr<unsigned char>(r), img.step, img.ptr<unsigned char>(r - h), img.step, h, img.cols);
+						}
+						else {
+							for (; r_hist < r; ++r_hist) {
+								hist.remove(img.ptr<unsigned char>(r_hist), img.ptr<unsigned char>(r_hist - h), img.cols);
+								hist.add(img.ptr<unsigned char>(r_hist + h), img.ptr<unsigned char>(r_hist), img.cols);
+							}
+						}
+						r_hist = r;
+
+						float SV = options.exact ? hist.MI(&Pa[0], &Pb[0]) : hist.fastMI(&Pa[0], &Pb[0]);
+						if (SV > SV_max(r)) {
+							SV_max(r) = SV;
+							h_max(r) = h;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	/**
+	* sweepを、optionsのスレッド数で実行する。
+	* 各stripeは多数のwork itemを1つのJointHistogramで処理するので、stripe数はスレッド数の数倍に抑える
+	* (nstripesを指定しないと、work itemごとにstripeが作られ、histogramもitemごとに確保される)。
+	*/
+	void runSymmetrySweep(const cv::ParallelLoopBody& sweep, int num_items, const SymmetryOptions& options) {
+		if (options.num_threads == 1) {
+			sweep(cv::Range(0, num_items));
+		}
+		else {
+			int num_threads = cv::getNumThreads();
+			if (options.num_threads > 0) cv::setNumThreads(options.num_threads);
+			cv::parallel_for_(cv::Range(0, num_items), sweep, cv::getNumThreads() * 4);
+			cv::setNumThreads(num_threads);
+		}
+	}
+
+	/**
+	* 各h in [h_start, h_end]、各rについて、[r, r+h)と[r-h, r)のMIを計算する。
+	* maskが与えられた場合は、maskが1の (h, r) だけを計算する。計算しなかった要素は0となる。
+	*
+	* @param img		Facade画像 (1-channel image)
+	* @param h_start	minimum h
+	* @param h_end		maximum h
+	* @param options	number of histogram bins, MI kernel and number of threads
+	* @param mask		(h_end - h_start + 1) x rows mask (NULL: all)
+	* @param SV			(h_end - h_start + 1) x rows MI
+	*/
+	void computeSVTable(const cv::Mat& img, int h_start, int h_end, const SymmetryOptions& options, const cv::Mat_<unsigned char>* mask, cv::Mat_<float>& SV) {
+		SV = cv::Mat_<float>(h_end - h_start + 1, img.rows, 0.0f);
+
+		// For each h, the window [r, r+h) vs [r-h, r) is slid downward by one row at a time,
+		// so only one row of pixel pairs has to be added and removed per step.
+		// The rows are split into blocks that are long enough compared to h to amortize the initial histogram.
+		std::vector<cv::Vec3i> items;
+		for (int h = h_start; h <= h_end; ++h) {
+			int block = std::max(64, h * 8);
+			for (int r = h; r + h < img.rows; r += block) {
+				items.push_back(cv::Vec3i(h, r, std::min(r + block, img.rows - h)));
+			}
+		}
+
+		// the marginal histograms of the row bands are taken from the integral histogram
+		IntegralHistogram integral_hist(img, options.bins);
+
+		SymmetrySweep sweep(img, integral_hist, items, h_start, options, mask, SV);
+		runSymmetrySweep(sweep, items.size(), options);
+	}
+
+	/**
+	* ピラミッドの粗いlevelから順に、S_max(y)、h_max(y)を計算する。
+	* 最も粗いlevelでは全てのhを調べ、各rについてMIの大きい上位top_k個のhを候補として残す。
+	* 1つ細かいlevelでは、各rについて、対応する粗いlevelの行の候補hを2倍した近傍 (±2) だけを調べる。
+	*
+	* @param img		Facade画像 (1-channel image)
+	* @param SV_max		S_max(y)
+	* @param h_max		h_max(y)
+	* @param h_start	minimum h
+	* @param h_end		maximum h
+	* @param options	number of pyramid levels, number of candidates, etc.
+	* @param stats		number of evaluated candidates (optional)
+	*/
+	void computeSVPyramid(const cv::Mat& img, cv::Mat_<float>& SV_max, cv::Mat_<int>& h_max, int h_start, int h_end, const SymmetryOptions& options, SymmetryStats* stats) {
+		const int H_RADIUS = 2;
+
+		std::vector<cv::Mat> pyramid(1, img);
+		for (int l = 0; l < options.pyramid_levels && pyramid.back().rows >= 64; ++l) {
+			cv::Mat down;
+			cv::pyrDown(pyramid.back(), down);
+			pyramid.push_back(down);
+		}
+
+		// candidates of h for each row at the current level
+		std::vector<std::vector<int> > candidates;
+		for (int l = pyramid.size() - 1; l >= 0; --l) {
+			int rows = pyramid[l].rows;
+			int hs = std::max(1, h_start >> l);
+			int he = std::min((h_end + (1 << l) - 1) >> l, (rows - 1) / 2);
+			if (l == 0) {
+				hs = h_start;
+				he = h_end;
+			}
+			if (he < hs) continue;
+
+			cv::Mat_<float> SV;
+			cv::Mat_<unsigned char> mask(he - hs + 1, rows, (unsigned char)0);
+			if (candidates.empty()) {
+				mask.setTo(1);
+			}
+			else {
+				for (int r = 0; r < rows; ++r) {
+					// the coarse rows that overlap this row
+					for (int rc = r / 2; rc <= std::min((r + 1) / 2, (int)candidates.size() - 1); ++rc) {
+						for (int i = 0; i < candidates[rc].size(); ++i) {
+							for (int h = candidates[rc][i] * 2 - H_RADIUS; h <= candidates[rc][i] * 2 + H_RADIUS; ++h) {
+								if (h < hs || h > he || r - h < 0 || r + h >= rows) continue;
+								mask(h - hs, r) = 1;
+							}
+						}
+					}
+				}
+			}
+			computeSVTable(pyramid[l], hs, he, options, &mask, SV);
+
+			if (stats != NULL) {
+				stats->num_evaluated += cv::countNonZero(mask);
+			}
+
+			if (l > 0) {
+				// keep the top k of h for each row
+				candidates.assign(rows, std::vector<int>());
+				for (int r = 0; r < rows; ++r) {
+					std::vector<std::pair<float, int> > values;
+					for (int h = hs; h <= he; ++h) {
+						if (mask(h - hs, r) && SV(h - hs, r) > 0) {
+							values.push_back(std::make_pair(-SV(h - hs, r), h));
+						}
+					}
+					int k = std::min(options.top_k, (int)values.size());
+					std::partial_sort(values.begin(), values.begin() + k, values.end());
+					for (int i = 0; i < k; ++i) {
+						candidates[r].push_back(values[i].second);
+					}
+				}
+			}
+			else {
+				for (int h = hs; h <= he; ++h) {
+					for (int r = 0; r < rows; ++r) {
+						if (SV(h - hs, r) > SV_max(r)) {
+							SV_max(r) = SV(h - hs, r);
+							h_max(r) = h;
+						}
+					}
+				}
+			}
+		}
+	}
+
 	/**
 	* Facade画像のS_max(y)、h_max(y)を計算する。
 	*
@@ -469,18 +1167,70 @@ namespace fs {
 	* @param SV_max		S_max(y)
 	* @param h_max		h_max(y)
 	* @param h_range	range of h
+	* @param options	number of histogram bins, MI kernel, number of threads, pruning and pyramid search
+	* @param stats		number of candidates, pruned candidates and evaluated candidates (optional)
 	*/
-	void computeSV(const cv::Mat& img, cv::Mat_<float>& SV_max, cv::Mat_<int>& h_max, const cv::Range& h_range) {
+	void computeSV(const cv::Mat& img, cv::Mat_<float>& SV_max, cv::Mat_<int>& h_max, const cv::Range& h_range, const SymmetryOptions& options, SymmetryStats* stats) {
 		SV_max = cv::Mat_<float>(img.rows, 1, 0.0f);
-		h_max = cv::Mat_<float>(img.rows, 1, 0.0f);
+		h_max = cv::Mat_<int>(img.rows, 1, 0);
 
-		printf("computing");
-		for (int r = 0; r < img.rows; ++r) {
-			printf("\rcomputing r = %d/%d  ", r, img.rows);
+		int h_start = std::max(1, h_range.start);
+		int h_end = std::min(h_range.end, (img.rows - 1) / 2);
+		if (h_end < h_start) return;
 
-			computeSV(img, r, SV_max(r), h_max(r), h_range);
+		long long num_candidates = 0;
+		for (int h = h_start; h <= h_end; ++h) {
+			num_candidates += img.rows - h * 2;
+		}
+		if (stats != NULL) {
+			stats->num_candidates += num_candidates;
+		}
+
+		if (options.pyramid_levels > 0) {
+			computeSVPyramid(img, SV_max, h_max, h_start, h_end, options, stats);
+			return;
+		}
+
+		if (options.prune) {
+			// The bound can prune only after a good h has been found for r, so all h of a row are visited by one thread.
+			// The blocks of rows are long enough to amortize the rebuilt histograms.
+			std::vector<cv::Vec2i> items;
+			int block = std::max(64, img.rows / 16);
+			for (int r = h_start; r + h_start < img.rows; r += block) {
+				items.push_back(cv::Vec2i(r, std::min(r + block, img.rows - h_start)));
+			}
+
+			IntegralHistogram integral_hist(img, options.bins);
+			std::vector<long long> num_pruned(items.size(), 0);
+			PrunedSymmetrySweep sweep(img, integral_hist, items, h_start, h_end, options, SV_max, h_max, num_pruned);
+			runSymmetrySweep(sweep, items.size(), options);
+
+			if (stats != NULL) {
+				for (int i = 0; i < num_pruned.size(); ++i) {
+					stats->num_pruned += num_pruned[i];
+					num_candidates -= num_pruned[i];
+				}
+				stats->num_evaluated += num_candidates;
+			}
+			return;
+		}
+
+		cv::Mat_<float> SV;
+		computeSVTable(img, h_start, h_end, options, NULL, SV);
+		if (stats != NULL) {
+			stats->num_evaluated += num_candidates;
+		}
+
+		// h is visited in ascending order for every r, so the result does not depend on the number of threads
+		// and the tie-breaking is the same as computeSV(img, r, ...).
+		for (int h = h_start; h <= h_end; ++h) {
+			for (int r = 0; r < img.rows; ++r) {
+				if (SV(h - h_start, r) > SV_max(r)) {
+					SV_max(r) = SV(h - h_start, r);
+					h_max(r) = h;
+				}
+			}
 		}
-		printf("\n");
 	}
 
 	void computeSV(const cv::Mat& img, int r, float& SV_max, int& h_max, const cv::Range& h_range) {
@@ -508,18 +1258,14 @@ namespace fs {
 	* @param SH_max	S_max(x)
 	* @param w_max		w_max(x)
 	* @param w_range	range of w
+	* @param options	number of histogram bins, MI kernel, number of threads and pruning
+	* @param stats		number of candidates and pruned candidates (optional)
 	*/
-	void computeSH(const cv::Mat& img, cv::Mat_<float>& SH_max, cv::Mat_<int>& w_max, const cv::Range& w_range) {
-		SH_max = cv::Mat_<float>(img.cols, 1, 0.0f);
-		w_max = cv::Mat_<float>(img.cols, 1, 0.0f);
-
-		printf("computing");
-		for (int c = 0; c < img.cols; ++c) {
-			printf("\rcomputing c = %d/%d  ", c, img.cols);
-
-			computeSH(img, c, SH_max(c), w_max(c), w_range);
-		}
-		printf("\n");
+	void computeSH(const cv::Mat& img, cv::Mat_<float>& SH_max, cv::Mat_<int>& w_max, const cv::Range& w_range, const SymmetryOptions& options, SymmetryStats* stats) {
+		// The pixel pairs of the column bands [c, c+w) and [c-w, c) are the same as
+		// those of the row bands of the transposed image, so the vertical sweep can be reused.
+		cv::Mat img_t = img.t();
+		computeSV(img_t, SH_max, w_max, w_range, options, stats);
 	}
 
 	void computeSH(const cv::Mat& img, int c, float& SH_max, int& w_max, const cv::Range& w_range) {
@@ -540,6 +1286,111 @@ namespace fs {
 		}
 	}
 
+	/**
+	* 256 binの元のMIに対する、指定したoptionsのS_max(y)、h_max(y)の精度と速度を出力する。
+	*
+	* @param img		Facade画像 (1-channel image)
+	* @param h_range	range of h
+	* @param options	number of histogram bins and MI kernel to be evaluated
+	*/
+	void reportSymmetryAccuracy(const cv::Mat& img, const cv::Range& h_range, const SymmetryOptions& options) {
+		cv::Mat_<float> SV_max_base, SV_max;
+		cv::Mat_<int> h_max_base, h_max;
+
+		int64 t0 = cv::getTickCount();
+		computeSV(img, SV_max_base, h_max_base, h_range);
+		int64 t1 = cv::getTickCount();
+		SymmetryStats stats;
+		computeSV(img, SV_max, h_max, h_range, options, &stats);
+		int64 t2 = cv::getTickCount();
+
+		// S_max is compared after normalizing both curves to [0, 1], since quantization scales MI down.
+		double min_base, max_base, min_val, max_val;
+		cv::minMaxLoc(SV_max_base, &min_base, &max_base);
+		cv::minMaxLoc(SV_max, &min_val, &max_val);
+
+		int num_same_h = 0;
+		int num_close_h = 0;
+		int total_h_diff = 0;
+		float max_diff = 0.0f;
+		float total_diff = 0.0f;
+		for (int r = 0; r < img.rows; ++r) {
+			if (h_max(r) == h_max_base(r)) num_same_h++;
+			if (std::abs(h_max(r) - h_max_base(r)) <= 1) num_close_h++;
+			total_h_diff += std::abs(h_max(r) - h_max_base(r));
+
+			float v1 = max_base > min_base ? (SV_max_base(r) - min_base) / (max_base - min_base) : 0.0f;
+			float v2 = max_val > min_val ? (SV_max(r) - min_val) / (max_val - min_val) : 0.0f;
+			max_diff = std::max(max_diff, std::abs(v1 - v2));
+			total_diff += std::abs(v1 - v2);
+		}
+
+		std::cout << "bins: " << options.bins << (options.exact ? " (exact)" : " (table)") << (options.prune ? " (pruned)" : "");
+		if (options.pyramid_levels > 0) {
+			std::cout << " (pyramid 1/" << (1 << options.pyramid_levels) << ", top " << options.top_k << ")";
+		}
+		std::cout << std::endl;
+		std::cout << "  time: " << (t1 - t0) / cv::getTickFrequency() << " sec (256 bins) -> " << (t2 - t1) / cv::getTickFrequency() << " sec" << std::endl;
+		std::cout << "  h_max same: " << (float)num_same_h / img.rows * 100 << " %, within 1px: " << (float)num_close_h / img.rows * 100 << " %, mean diff: " << (float)total_h_diff / img.rows << " px" << std::endl;
+		std::cout << "  normalized S_max diff: mean " << total_diff / img.rows << ", max " << max_diff << std::endl;
+		std::cout << "  evaluated: " << stats.num_evaluated << " / " << stats.num_candidates << std::endl;
+		if (options.prune) {
+			std::cout << "  pruned: " << stats.num_pruned << " / " << stats.num_candidates << " (" << (stats.num_candidates > 0 ? (float)stats.num_pruned / stats.num_candidates * 100 : 0.0f) << " %)" << std::endl;
+		}
+	}
+
+	/**
+	* 元の実装 (cv::Mat_<float>とat<>) に対する、JointHistogramのhistogram構築の速度を出力する。
+	* 画像全体の幅の、いくつかの高さのstripについて、1回あたりの時間を計測する。
+	*
+	* @param img		Facade画像 (1-channel image)
+	*/
+	void reportJointHistogramSpeed(const cv::Mat& img) {
+		int heights[] = { 8, 16, 32, 64, 128 };
+		for (int k = 0; k < 5; ++k) {
+			int h = heights[k];
+			if (h * 2 > img.rows) break;
+
+			std::vector<int> rs;
+			for (int r = h; r + h <= img.rows; r += std::max(1, (img.rows - h * 2) / 16)) {
+				rs.push_back(r);
+			}
+
+			// the original histogram construction
+			int64 t0 = cv::getTickCount();
+			for (int i = 0; i < rs.size(); ++i) {
+				cv::Mat R1 = img(cv::Rect(0, rs[i], img.cols, h));
+				cv::Mat R2 = img(cv::Rect(0, rs[i] - h, img.cols, h));
+				cv::Mat_<float> Pab(256, 256, 0.0f);
+				cv::Mat_<float> Pa(256, 1, 0.0f);
+				cv::Mat_<float> Pb(256, 1, 0.0f);
+				for (int r = 0; r < R1.rows; ++r) {
+					for (int c = 0; c < R1.cols; ++c) {
+						int a = R1.at<unsigned char>(r, c);
+						int b = R2.at<unsigned char>(r, c);
+
+						Pab(a, b)++;
+						Pa(a, 0)++;
+						Pb(b, 0)++;
+					}
+				}
+			}
+			int64 t1 = cv::getTickCount();
+
+			// the vectorized construction
+			JointHistogram hist;
+			for (int i = 0; i < rs.size(); ++i) {
+				hist.clear();
+				hist.addRows(img.ptr<unsigned char>(rs[i]), img.step, img.ptr<unsigned char>(rs[i] - h), img.step, h, img.cols);
+			}
+			int64 t2 = cv::getTickCount();
+
+			double time_base = (t1 - t0) / cv::getTickFrequency() / rs.size() * 1000000;
+			double time_simd = (t2 - t1) / cv::getTickFrequency() / rs.size() * 1000000;
+			std::cout << "strip " << img.cols << "x" << h << ": " << time_base << " us -> " << time_simd << " us (x" << time_base / time_simd << ")" << std::endl;
+		}
+	}
+
 	/**
 	* imgから、Ver(y)とHor(x)を計算する。
 	*
@@ -602,15 +1453,29 @@ namespace fs {
 		Ver = cv::Mat_<float>(grayImg.rows, 1, 0.0f);
 		Hor = cv::Mat_<float>(1, grayImg.cols, 0.0f);
 		float beta = 0.1f;
+
+		// The profiles are convolved with the cached Gaussian kernel truncated at 6 sigma,
+		// where the weight relative to the center is below the float precision (exp(-18)).
+		// The terms outside the image are not added as before, so the boundary handling is the same.
+		utils::GaussianKernel kernel(sigma);
+		std::vector<float> ver_profile(grayImg.rows);
+		for (int rr = 0; rr < grayImg.rows; ++rr) {
+			ver_profile[rr] = ver_xtotal.at<float>(rr, 0) - beta * hor_xtotal.at<float>(rr, 0);
+		}
+		std::vector<float> ver_smoothed;
+		kernel.convolve(ver_profile, ver_smoothed);
 		for (int r = 0; r < grayImg.rows; ++r) {
-			for (int rr = 0; rr < grayImg.rows; ++rr) {
-				Ver(r, 0) += (ver_xtotal.at<float>(rr, 0) - beta * hor_xtotal.at<float>(rr, 0)) * utils::gause(rr - r, sigma);
-			}
+			Ver(r, 0) = ver_smoothed[r];
 		}
+
+		std::vector<float> hor_profile(grayImg.cols);
+		for (int cc = 0; cc < grayImg.cols; ++cc) {
+			hor_profile[cc] = hor_ytotal.at<float>(0, cc) - beta * ver_ytotal.at<float>(0, cc);
+		}
+		std::vector<float> hor_smoothed;
+		kernel.convolve(hor_profile, hor_smoothed);
 		for (int c = 0; c < grayImg.cols; ++c) {
-			for (int cc = 0; cc < grayImg.cols; ++cc) {
-				Hor(0, c) += (hor_ytotal.at<float>(0, cc) - beta * ver_ytotal.at<float>(0, cc)) * utils::gause(cc - c, sigma);
-			}
+			Hor(0, c) = hor_smoothed[c];
 		}
 	}
 
@@ -624,22 +1489,36 @@ namespace fs {
 		// smoothing
 		//cv::GaussianBlur(grayImg, grayImg, cv::Size(5, 5), 5, 5);
 
-		// compute gradient magnitude
-		cv::Mat sobelx;
-		cv::Sobel(grayImg, sobelx, CV_32F, 1, 0);
-		sobelx = cv::abs(sobelx);
-		cv::Mat sobely;
-		cv::Sobel(grayImg, sobely, CV_32F, 0, 1);
-		sobely = cv::abs(sobely);
-
 		// sum up the gradient magnitude horizontally and vertically
-		cv::Mat sobelx_hor, sobelx_ver;
-		cv::reduce(sobelx, sobelx_hor, 0, CV_REDUCE_SUM);
-		cv::reduce(sobelx, sobelx_ver, 1, CV_REDUCE_SUM);
-		cv::Mat sobely_hor, sobely_ver;
-		cv::reduce(sobely, sobely_hor, 0, CV_REDUCE_SUM);
-		cv::reduce(sobely, sobely_ver, 1, CV_REDUCE_SUM);
+		cv::Mat_<float> sobelx_hor, sobelx_ver;
+		cv::Mat_<float> sobely_hor, sobely_ver;
+		sumSobelMagnitude(grayImg, sobelx_ver, sobelx_hor, sobely_ver, sobely_hor);
+
+		combineVerAndHor(sobelx_ver, sobelx_hor, sobely_ver, sobely_hor, alpha, Ver, Hor);
+	}
+
+	/**
+	* Facade全体のGradientIntegralから、tileのVer(y)とHor(x)を計算する。
+	* tileの境界でも、Facade内の隣接画素を使った勾配となる。
+	*
+	* @param grad		gradient integral of the facade
+	* @param rect		tile
+	* @param Ver		Ver(y)
+	* @param Hor		Hor(x)
+	* @param alpha		weight of the gradient of the other direction
+	*/
+	void computeVerAndHor2(const GradientIntegral& grad, const cv::Rect& rect, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor, float alpha) {
+		cv::Mat_<float> sobelx_hor, sobelx_ver;
+		cv::Mat_<float> sobely_hor, sobely_ver;
+		grad.sum(rect, sobelx_ver, sobelx_hor, sobely_ver, sobely_hor);
+
+		combineVerAndHor(sobelx_ver, sobelx_hor, sobely_ver, sobely_hor, alpha, Ver, Hor);
+	}
 
+	/**
+	* |Gx|、|Gy|の行ごとの和と列ごとの和から、正規化したVer(y)とHor(x)を計算する。
+	*/
+	void combineVerAndHor(const cv::Mat_<float>& sobelx_ver, const cv::Mat_<float>& sobelx_hor, const cv::Mat_<float>& sobely_ver, const cv::Mat_<float>& sobely_hor, float alpha, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor) {
 		// compute Ver and Hor
 		Ver = sobelx_ver - sobely_ver * alpha;
 		Hor = sobely_hor - sobelx_hor * alpha;
@@ -658,23 +1537,188 @@ namespace fs {
 	}
 
 	/**
-	* 与えられた関数の極小値を使ってsplit lineを決定する。
+	* 1次元のprofileの主要な周期を、自己相関から推定する。
+	* 自己相関は、2倍以上にzero paddingしたprofileのpower spectrumの逆DFTとして、O(N log N)で計算する。
+	* [min_period, max_period]内の自己相関の極大のうち、最大値の0.85倍以上のものの中で最も短い周期を選ぶ。
+	* (周期の整数倍も同じくらい強い極大になるため)
+	* 極大がない、または相関が弱い場合は、profileの長さを返す。
+	*
+	* @param profile		profile (N x 1 or 1 x N)
+	* @param min_period		minimum period
+	* @param max_period		maximum period (at most N / 2)
+	* @return				period
 	*/
-	void getSplitLines(const cv::Mat_<float>& val, float threshold, std::vector<float>& split_positions) {
-		cv::Mat_<float> mat = val.clone();
-		if (mat.rows == 1) {
-			mat = mat.t();
+	float estimatePeriod(const cv::Mat_<float>& profile, float min_period, float max_period) {
+		int N = profile.total();
+		cv::Mat_<float> x = profile.clone().reshape(1, 1);
+		x -= cv::mean(x)[0];
+
+		// autocorrelation by the Wiener-Khinchin theorem
+		cv::Mat_<float> padded(1, cv::getOptimalDFTSize(N * 2), 0.0f);
+		x.copyTo(padded(cv::Rect(0, 0, N, 1)));
+		cv::Mat spectrum, power;
+		cv::dft(padded, spectrum, cv::DFT_COMPLEX_OUTPUT);
+		cv::mulSpectrums(spectrum, spectrum, power, 0, true);
+		cv::Mat_<float> acf;
+		cv::dft(power, acf, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+		if (acf(0, 0) <= 0) return N;
+
+		// unbiased and normalized autocorrelation
+		int lag_start = std::max(1, (int)min_period);
+		int lag_end = std::min((int)max_period, N / 2);
+		if (lag_end - lag_start < 2) return N;
+		std::vector<float> r(lag_end + 2);
+		for (int lag = lag_start - 1; lag <= lag_end + 1; ++lag) {
+			r[lag] = acf(0, lag) / acf(0, 0) * N / (N - lag);
+		}
+
+		// local maxima
+		std::vector<int> peaks;
+		float max_r = 0.0f;
+		for (int lag = lag_start; lag <= lag_end; ++lag) {
+			if (r[lag] > r[lag - 1] && r[lag] >= r[lag + 1] && r[lag] > 0) {
+				peaks.push_back(lag);
+				max_r = std::max(max_r, r[lag]);
+			}
 		}
+		if (peaks.size() == 0 || max_r < 0.1f) return N;
 
-		double max_value, min_value;
-		cv::minMaxLoc(mat, &min_value, &max_value);
-		threshold *= (max_value - min_value);
+		int lag = 0;
+		for (int i = 0; i < peaks.size(); ++i) {
+			if (r[peaks[i]] >= max_r * 0.85f) {
+				lag = peaks[i];
+				break;
+			}
+		}
+
+		// parabolic interpolation of the peak
+		float denom = r[lag - 1] - 2 * r[lag] + r[lag + 1];
+		float offset = denom < 0 ? 0.5f * (r[lag - 1] - r[lag + 1]) / denom : 0.0f;
+
+		return lag + std::max(-0.5f, std::min(0.5f, offset));
+	}
+
+	/**
+	* Facade画像のVer(y)、Hor(x)の周期から、階の高さと列の幅を推定する。
+	* 周期が見つからない方向は、画像全体を1つの階 (列) とする。
+	*
+	* @param img					Facade画像 (3-channel color image)
+	* @param average_floor_height	floor height
+	* @param average_column_width	column width
+	*/
+	void estimateFloorHeightAndColumnWidth(const cv::Mat& img, float& average_floor_height, float& average_column_width) {
+		cv::Mat gray_img;
+		cv::cvtColor(img, gray_img, cv::COLOR_BGR2GRAY);
+
+		cv::Mat_<float> Ver, Hor;
+		computeVerAndHor2(gray_img, Ver, Hor, 0.0);
+
+		average_floor_height = estimatePeriod(Ver, std::max(8.0f, img.rows / 30.0f), img.rows / 2.0f);
+		average_column_width = estimatePeriod(Hor, std::max(8.0f, img.cols / 30.0f), img.cols / 2.0f);
+	}
 
-		for (int r = 0; r < mat.rows; ++r) {
-			if (isLocalMinimum(mat, r, threshold)) {
-				split_positions.push_back(r);
+	/**
+	* sumSobelMagnitudeの並列処理。
+	* 各work itemは行のstripで、行ごとの和は直接書き込み、列ごとの和はstripごとのバッファに足す。
+	* 各行の|Gx|、|Gy|は、GradientIntegralと同じsobelMagnitudeRowで計算する。
+	*/
+	class SobelMagnitudeSum : public cv::ParallelLoopBody {
+	private:
+		const cv::Mat& gray;
+		int strip;
+		cv::Mat_<int>& x_rows;
+		cv::Mat_<int>& y_rows;
+		cv::Mat_<int>& x_cols;
+		cv::Mat_<int>& y_cols;
+
+	public:
+		SobelMagnitudeSum(const cv::Mat& gray, int strip, cv::Mat_<int>& x_rows, cv::Mat_<int>& y_rows, cv::Mat_<int>& x_cols, cv::Mat_<int>& y_cols) : gray(gray), strip(strip), x_rows(x_rows), y_rows(y_rows), x_cols(x_cols), y_cols(y_cols) {}
+
+		void operator()(const cv::Range& range) const {
+			int cols = gray.cols;
+			std::vector<unsigned short> gx(cols), gy(cols);
+			for (int i = range.start; i < range.end; ++i) {
+				unsigned int* sum_x = (unsigned int*)x_cols.ptr<int>(i);
+				unsigned int* sum_y = (unsigned int*)y_cols.ptr<int>(i);
+
+				for (int r = i * strip; r < std::min((i + 1) * strip, gray.rows); ++r) {
+					sobelMagnitudeRow(gray, r, &gx[0], &gy[0]);
+					unsigned int row_x = 0;
+					unsigned int row_y = 0;
+					for (int c = 0; c < cols; ++c) {
+						row_x += gx[c];
+						row_y += gy[c];
+						sum_x[c] += gx[c];
+						sum_y[c] += gy[c];
+					}
+
+					x_rows(r, 0) = row_x;
+					y_rows(r, 0) = row_y;
+				}
+			}
+		}
+	};
+
+	/**
+	* 3x3のSobelの|Gx|、|Gy|の、行ごとの和と列ごとの和を計算する。
+	* cv::Sobel、cv::abs、cv::reduceと同じ値を、勾配画像を作らずに1回の走査で計算する。
+	* 和は整数で計算するので、cv::reduceのfloatの和と一致する (和が2^24を超えない限り)。
+	*
+	* @param gray		image (1-channel 8-bit image)
+	* @param x_rows		sum of |Gx| for each row (rows x 1)
+	* @param x_cols		sum of |Gx| for each column (1 x cols)
+	* @param y_rows		sum of |Gy| for each row (rows x 1)
+	* @param y_cols		sum of |Gy| for each column (1 x cols)
+	*/
+	void sumSobelMagnitude(const cv::Mat& gray, cv::Mat_<float>& x_rows, cv::Mat_<float>& x_cols, cv::Mat_<float>& y_rows, cv::Mat_<float>& y_cols) {
+		// the rows are split into strips, and each strip has its own column sums
+		int num_strips = std::max(1, std::min(gray.rows / 16, cv::getNumThreads() * 4));
+		int strip = (gray.rows + num_strips - 1) / num_strips;
+		num_strips = (gray.rows + strip - 1) / strip;
+
+		cv::Mat_<int> sum_x_rows(gray.rows, 1), sum_y_rows(gray.rows, 1);
+		cv::Mat_<int> sum_x_cols(num_strips, gray.cols, 0), sum_y_cols(num_strips, gray.cols, 0);
+		cv::parallel_for_(cv::Range(0, num_strips), SobelMagnitudeSum(gray, strip, sum_x_rows, sum_y_rows, sum_x_cols, sum_y_cols));
+
+		sum_x_rows.convertTo(x_rows, CV_32F);
+		sum_y_rows.convertTo(y_rows, CV_32F);
+		x_cols = cv::Mat_<float>(1, gray.cols, 0.0f);
+		y_cols = cv::Mat_<float>(1, gray.cols, 0.0f);
+		for (int c = 0; c < gray.cols; ++c) {
+			unsigned int sum_x = 0;
+			unsigned int sum_y = 0;
+			for (int i = 0; i < num_strips; ++i) {
+				sum_x += sum_x_cols(i, c);
+				sum_y += sum_y_cols(i, c);
 			}
+			x_cols(0, c) = sum_x;
+			y_cols(0, c) = sum_y;
 		}
+	}
+
+	/**
+	* 与えられた関数の極小値を使ってsplit lineを決定する。
+	*/
+	void getSplitLines(const cv::Mat_<float>& val, float threshold, std::vector<float>& split_positions) {
+		getSplitLines(MinimaHierarchy(val), threshold, split_positions);
+	}
+
+	/**
+	 * Find the split lines from the minima hierarchy of the profile.
+	 * Building the hierarchy once and querying it for each threshold avoids rescanning the profile.
+	 *
+	 * @param hierarchy			minima hierarchy of the profile
+	 * @param threshold			threshold of the prominence relative to the range of the profile
+	 * @param split_positions	[OUT] split lines
+	 */
+	void getSplitLines(const MinimaHierarchy& hierarchy, float threshold, std::vector<float>& split_positions) {
+		// minima whose prominence exceeds the threshold
+		std::vector<int> minima;
+		hierarchy.minimaAbove(threshold, minima);
+		for (int i = 0; i < minima.size(); ++i) {
+			split_positions.push_back(minima[i]);
+		}
+		int length = hierarchy.numSamples();
 
 		// remove the consecutive ones
 		for (int i = 0; i < (int)split_positions.size() - 1;) {
@@ -691,7 +1735,7 @@ namespace fs {
 			if (split_positions[0] <= 1) {
 				split_positions.erase(split_positions.begin());
 			}
-			if (split_positions.back() >= mat.rows - 2) {
+			if (split_positions.back() >= length - 2) {
 				split_positions.pop_back();
 			}
 		}
@@ -710,12 +1754,12 @@ namespace fs {
 			}
 		}
 
-		if (split_positions.back() < mat.rows - 1) {
-			if (split_positions.back() >= mat.rows - 5) {
-				split_positions.back() = mat.rows - 1;
+		if (split_positions.back() < length - 1) {
+			if (split_positions.back() >= length - 5) {
+				split_positions.back() = length - 1;
 			}
 			else {
-				split_positions.push_back(mat.rows - 1);
+				split_positions.push_back(length - 1);
 			}
 		}
 		*/
@@ -759,104 +1803,200 @@ namespace fs {
 	 * 分割線の一部を削除し、分割線の間隔が等間隔に近くなるようにする。
 	 */
 	void distributeSplitLines(std::vector<float>& split_positions, float threshold) {
-		std::vector<int> flags(split_positions.size() - 2, 0);
+		int n = split_positions.size();
+		if (n <= 2) return;
+
+		// The first and the last lines are always kept, and the sum of the intervals is fixed.
+		// Thus, for a fixed number of intervals, the stddev of intervals is minimized by minimizing the sum of squared intervals,
+		// which is solved by dynamic programming over (#intervals, last kept line).
+		// sq_sum[m * n + j]: the minimum sum of squared intervals from the first line to the j-th line with m intervals
+		std::vector<double> sq_sum(n * n, std::numeric_limits<double>::infinity());
+		std::vector<int> prev(n * n, -1);
+		sq_sum[0] = 0;
+		for (int m = 1; m < n; ++m) {
+			for (int j = m; j < n; ++j) {
+				for (int i = m - 1; i < j; ++i) {
+					if (sq_sum[(m - 1) * n + i] == std::numeric_limits<double>::infinity()) continue;
+
+					double d = split_positions[j] - split_positions[i];
+					double s = sq_sum[(m - 1) * n + i] + d * d;
+					if (s < sq_sum[m * n + j]) {
+						sq_sum[m * n + j] = s;
+						prev[m * n + j] = i;
+					}
+				}
+			}
+		}
 
 		float min_stddev = std::numeric_limits<float>::max();
-		std::vector<int> min_flags;
+		std::vector<int> min_lines;
+		for (int m = 1; m < n; ++m) {
+			// valid only if the kept lines are more than the threshold
+			if ((float)(m + 1) / split_positions.size() <= threshold) continue;
+
+			// the lines of the best subset with m intervals
+			std::vector<int> lines;
+			for (int j = n - 1, k = m; j >= 0; j = prev[k * n + j], --k) {
+				lines.push_back(j);
+			}
+			std::reverse(lines.begin(), lines.end());
 
-		while (true) {
-			// count 1s
-			int cnt_ones = 0;
-			for (int i = 0; i < flags.size(); ++i) {
-				if (flags[i] == 1) cnt_ones++;
-			}
-
-			// valid only if 1s are more than 50%
-			if ((float)(cnt_ones + 2) / split_positions.size() > threshold) {
-				// compute the distances between split lines
-				std::vector<float> intervals;
-				float prev_pos = split_positions[0];
-				for (int i = 1; i < split_positions.size(); ++i) {
-					if (i < split_positions.size() - 1 && flags[i - 1] == 0) continue;
-
-					intervals.push_back(split_positions[i] - prev_pos);
-					prev_pos = split_positions[i];
-				}
+			// compute the stddev of intervals
+			std::vector<float> intervals;
+			for (int i = 0; i < (int)lines.size() - 1; ++i) {
+				intervals.push_back(split_positions[lines[i + 1]] - split_positions[lines[i]]);
+			}
+			float stddev = utils::stddev(intervals);
+
+			// update the minimum stddev
+			if (stddev < min_stddev) {
+				min_stddev = stddev;
+				min_lines = lines;
+			}
+		}
+
+		// if no subset is valid, keep all the lines
+		if (min_lines.empty()) return;
+
+		std::vector<float> tmp = split_positions;
+		split_positions.clear();
+		for (int i = 0; i < min_lines.size(); ++i) {
+			split_positions.push_back(tmp[min_lines[i]]);
+		}
+	}
 
-				// compute the stddev of intervals
-				float stddev = utils::stddev(intervals);
+	/**
+	* 重み付きの値のGaussian kernel density (sigma) が最大となる、[0, size) の整数を返却する。
+	* 値はソート済みで、同じ値をまとめてから、各distinct valueからmean-shiftを最大max_iter回行い、
+	* 収束点に最も近い整数から、整数上の密度で山登りして極大に達した整数どうしを比べる。密度が同じ場合は、小さい方を返す。
+	* mean-shiftがmax_iter回で収束しなくても山登りで極大には達するので、結果は整数上の密度の極大値のうち、
+	* いずれかのdistinct valueから到達できたものの最大となる。極大が全てのdistinct valueから到達できれば、
+	* 全ての整数の密度のargmaxと一致する (max_iterが小さいと、到達できない極大を見落とす可能性がある)。
+	* [0, size) の全ての整数で密度が0 (全ての値がkernelの半径より離れている) の場合は、-1を返す。
+	*
+	* @param values		ソート済みの値
+	* @param gaussian		Gaussian kernel
+	* @param max_iter		mean-shiftの最大の繰り返し回数
+	* @param size			返却値の範囲
+	* @return				密度が最大の整数
+	*/
+	static int findMode(const std::vector<int>& values, const utils::GaussianKernel& gaussian, int max_iter, int size) {
+		const std::vector<float>& kernel = gaussian.weights();
+		int radius = gaussian.radius();
+		float sigma = gaussian.sigma();
+
+		// distinct values and their counts
+		std::vector<int> distinct;
+		std::vector<int> counts;
+		for (int k = 0; k < values.size(); ++k) {
+			if (k > 0 && values[k] == values[k - 1]) {
+				counts.back()++;
+			}
+			else {
+				distinct.push_back(values[k]);
+				counts.push_back(1);
+			}
+		}
 
-				// update the minimum stddev
-				if (stddev < min_stddev) {
-					min_stddev = stddev;
-					min_flags = flags;
+		// kernel density at an integer position
+		auto density = [&](int x) {
+			float total = 0.0f;
+			for (int k = std::lower_bound(distinct.begin(), distinct.end(), x - radius) - distinct.begin(); k < distinct.size() && distinct[k] <= x + radius; ++k) {
+				total += counts[k] * kernel[std::abs(distinct[k] - x)];
+			}
+			return total;
+		};
+
+		int best = -1;
+		float best_density = 0.0f;
+		for (int k = 0; k < distinct.size(); ++k) {
+			// mean-shift from the value
+			float y = distinct[k];
+			for (int iter = 0; iter < max_iter; ++iter) {
+				float total = 0.0f;
+				float weighted_total = 0.0f;
+				for (int l = std::lower_bound(distinct.begin(), distinct.end(), (int)std::floor(y - radius)) - distinct.begin(); l < distinct.size() && distinct[l] <= y + radius; ++l) {
+					float w = counts[l] * std::exp(-(distinct[l] - y) * (distinct[l] - y) / 2.0f / sigma / sigma);
+					total += w;
+					weighted_total += w * distinct[l];
 				}
+				float new_y = weighted_total / total;
+				bool converged = std::abs(new_y - y) < 0.01f;
+				y = new_y;
+				if (converged) break;
 			}
 
-			// next permutation
-			bool carried = false;
-			for (int i = 0; i < flags.size(); ++i) {
-				if (flags[i] == 1) {
-					flags[i] = 0;
+			// climb the integer density from the integer closest to the mode
+			// (to the left also on a tie, so that the smallest integer of a plateau is taken)
+			int c = std::min(std::max(cvRound(y), 0), size - 1);
+			float d = density(c);
+			while (true) {
+				if (c > 0 && density(c - 1) >= d && density(c - 1) > 0) {
+					c--;
+				}
+				else if (c < size - 1 && density(c + 1) > d) {
+					c++;
 				}
-				else if (flags[i] == 0) {
-					flags[i] = 1;
-					carried = true;
+				else {
 					break;
 				}
+				d = density(c);
 			}
-			if (!carried) break;
-		}
 
-		std::vector<float> tmp = split_positions;
-		split_positions.clear();
-		for (int i = 0; i < tmp.size(); ++i) {
-			if (i == 0 || i == tmp.size() - 1) {
-				split_positions.push_back(tmp[i]);
-			}
-			else if (min_flags[i - 1] == 1) {
-				split_positions.push_back(tmp[i]);
+			if (d > best_density || (d == best_density && d > 0 && c < best)) {
+				best_density = d;
+				best = c;
 			}
 		}
+
+		return best;
 	}
 
+	/**
+	* 窓の座標を、カラムごと (left/right) とフロアごと (top/bottom) にそろえる。
+	* 各カラム、各フロアの座標を1回の走査で集めてソートし、mean-shiftで最頻値を求める。
+	* edge_imgは使用しない。
+	*
+	* @param edge_img		edge image
+	* @param y_split		y coordinates of the floor boundaries
+	* @param x_split		x coordinates of the column boundaries
+	* @param winpos		[IN/OUT] windows of each tile
+	* @param max_iter		mean-shiftの最大の繰り返し回数
+	*/
 	void align(const cv::Mat& edge_img, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>> &winpos, int max_iter) {
-		// 窓のX座標をvoteする
-		for (int j = 0; j < x_split.size() - 1; ++j) {
-			int max_left, max_right;
-
-			// voteする
-			std::vector<float> histogram1(x_split[j + 1] - x_split[j], 0);
-			std::vector<float> histogram2(x_split[j + 1] - x_split[j], 0);
-			int count = 0;
-			for (int i = 0; i < y_split.size() - 1; ++i) {
+		int num_floors = y_split.size() - 1;
+		int num_columns = x_split.size() - 1;
+
+		// 窓の座標を、カラムごとおよびフロアごとに集める
+		std::vector<std::vector<int>> lefts(num_columns), rights(num_columns);
+		std::vector<std::vector<int>> tops(num_floors), bottoms(num_floors);
+		for (int i = 0; i < num_floors; ++i) {
+			for (int j = 0; j < num_columns; ++j) {
 				if (!winpos[i][j].valid) continue;
 
-				count++;
-				for (int c = 0; c < histogram1.size(); ++c) {
-					histogram1[c] += utils::gause(winpos[i][j].left - c, 2);
-					histogram2[c] += utils::gause(winpos[i][j].right - c, 2);
-				}
+				lefts[j].push_back(winpos[i][j].left);
+				rights[j].push_back(winpos[i][j].right);
+				tops[i].push_back(winpos[i][j].top);
+				bottoms[i].push_back(winpos[i][j].bottom);
 			}
+		}
 
-			if (count == 0) continue;
+		// voteのkernelは、全てのカラム、フロアで共有する
+		utils::GaussianKernel gaussian(2);
 
-			// max voteを探す
-			float max_val1 = 0.0f;
-			float max_val2 = 0.0f;
-			for (int c = 0; c < histogram1.size(); ++c) {
-				if (histogram1[c] > max_val1) {
-					max_val1 = histogram1[c];
-					max_left = c;
-				}
-				if (histogram2[c] > max_val2) {
-					max_val2 = histogram2[c];
-					max_right = c;
-				}
-			}
+		// 窓のX座標の最頻値を求める
+		for (int j = 0; j < num_columns; ++j) {
+			int width = x_split[j + 1] - x_split[j];
+			if (lefts[j].empty() || width <= 0) continue;
+
+			std::sort(lefts[j].begin(), lefts[j].end());
+			std::sort(rights[j].begin(), rights[j].end());
+			int max_left = findMode(lefts[j], gaussian, max_iter, width);
+			int max_right = findMode(rights[j], gaussian, max_iter, width);
+			if (max_left < 0 || max_right < 0) continue;
 
 			// 全てのフロアの窓のX座標をそろえる
-			for (int r = 0; r < y_split.size() - 1; ++r) {
+			for (int r = 0; r < num_floors; ++r) {
 				if (!winpos[r][j].valid) continue;
 
 				if (r == 0 || r == y_split.size() - 1) {
@@ -874,46 +2014,187 @@ namespace fs {
 			}
 		}
 
-		// 窓のY座標をvoteする
-		for (int i = 0; i < y_split.size() - 1; ++i) {
-			int max_top, max_bottom;
+		// 窓のY座標の最頻値を求める
+		for (int i = 0; i < num_floors; ++i) {
+			int height = y_split[i + 1] - y_split[i];
+			if (tops[i].empty() || height <= 0) continue;
 
-			// voteする
-			std::vector<float> histogram1(y_split[i + 1] - y_split[i], 0);
-			std::vector<float> histogram2(y_split[i + 1] - y_split[i], 0);
-			int count = 0;
-			for (int j = 0; j < x_split.size() - 1; ++j) {
-				if (!winpos[i][j].valid) continue;
+			std::sort(tops[i].begin(), tops[i].end());
+			std::sort(bottoms[i].begin(), bottoms[i].end());
+			int max_top = findMode(tops[i], gaussian, max_iter, height);
+			int max_bottom = findMode(bottoms[i], gaussian, max_iter, height);
+			if (max_top < 0 || max_bottom < 0) continue;
 
-				count++;
-				for (int r = 0; r < histogram1.size(); ++r) {
-					histogram1[r] += utils::gause(winpos[i][j].top - r, 2);
-					histogram2[r] += utils::gause(winpos[i][j].bottom - r, 2);
-				}
+			// 全てのカラムの窓のY座標をそろえる
+			for (int c = 0; c < num_columns; ++c) {
+				if (!winpos[i][c].valid) continue;
+
+				winpos[i][c].top = max_top;
+				winpos[i][c].bottom = max_bottom;
 			}
+		}
+	}
 
-			if (count == 0) continue;
+	/**
+	* 窓のエネルギーを返却する。
+	* 4辺それぞれの上のedge画素の割合の和を負にしたものに、カラム/フロアの代表座標 (target) からのずれ
+	* (tileの幅/高さで正規化) のlambda倍を足す。各辺のedgeの数はEdgeIntegralからO(1)で求まる。
+	*
+	* @param win			窓 (tileに対する相対座標)
+	* @param tile			tile
+	* @param edges			edge integral of the facade
+	* @param target		カラムのleft/rightとフロアのtop/bottomの代表値
+	* @param lambda		ずれの重み
+	* @return				エネルギー
+	*/
+	float computeEnergy(const WindowPos& win, const cv::Rect& tile, const EdgeIntegral& edges, const WindowPos& target, float lambda) {
+		int x1 = tile.x + win.left;
+		int x2 = tile.x + win.right;
+		int y1 = tile.y + win.top;
+		int y2 = tile.y + win.bottom;
+		float w = x2 - x1 + 1;
+		float h = y2 - y1 + 1;
+
+		float support = edges.countCol(x1, y1, y2 + 1) / h + edges.countCol(x2, y1, y2 + 1) / h
+			+ edges.countRow(y1, x1, x2 + 1) / w + edges.countRow(y2, x1, x2 + 1) / w;
+		float deviation = (float)(std::abs(win.left - target.left) + std::abs(win.right - target.right)) / tile.width
+			+ (float)(std::abs(win.top - target.top) + std::abs(win.bottom - target.bottom)) / tile.height;
+
+		return -support + lambda * deviation;
+	}
 
-			// max voteを探す
-			float max_val1 = 0.0f;
-			float max_val2 = 0.0f;
-			for (int r = 0; r < histogram1.size(); ++r) {
-				if (histogram1[r] > max_val1) {
-					max_val1 = histogram1[r];
-					max_top = r;
+	/**
+	* 窓の各辺をedgeに合わせるように、エネルギー最小化で窓の位置を修正する。
+	* 各iterationで、カラムごとのleft/right、フロアごとのtop/bottomの中央値を代表値とし、
+	* 各窓の各辺を現在の位置の +/- radius の範囲で動かしてエネルギーが最小の位置を選ぶ (coordinate descent)。
+	* 探索範囲を限定するので、辺が遠くのedge (コーニス、窓台、tileの境界など) に飛ぶことはない。
+	* 変化がなくなるか、max_iter回繰り返したら終了する。
+	*
+	* @param edges			edge integral of the facade
+	* @param y_split		y coordinates of the floor boundaries
+	* @param x_split		x coordinates of the column boundaries
+	* @param winpos		[IN/OUT] windows of each tile
+	* @param max_iter		最大の繰り返し回数
+	* @param lambda		代表値からのずれの重み
+	* @param radius		各辺の探索範囲
+	*/
+	void refineWindows(const EdgeIntegral& edges, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, int max_iter, float lambda, int radius) {
+		int num_floors = y_split.size() - 1;
+		int num_columns = x_split.size() - 1;
+
+		for (int iter = 0; iter < max_iter; ++iter) {
+			// カラム/フロアごとの代表値 (中央値)
+			std::vector<WindowPos> column_targets(num_columns), floor_targets(num_floors);
+			for (int j = 0; j < num_columns; ++j) {
+				std::vector<int> lefts, rights;
+				for (int i = 0; i < num_floors; ++i) {
+					if (winpos[i][j].valid != WindowPos::VALID) continue;
+					lefts.push_back(winpos[i][j].left);
+					rights.push_back(winpos[i][j].right);
 				}
-				if (histogram2[r] > max_val2) {
-					max_val2 = histogram2[r];
-					max_bottom = r;
+				if (lefts.empty()) continue;
+				std::nth_element(lefts.begin(), lefts.begin() + lefts.size() / 2, lefts.end());
+				std::nth_element(rights.begin(), rights.begin() + rights.size() / 2, rights.end());
+				column_targets[j].left = lefts[lefts.size() / 2];
+				column_targets[j].right = rights[rights.size() / 2];
+			}
+			for (int i = 0; i < num_floors; ++i) {
+				std::vector<int> tops, bottoms;
+				for (int j = 0; j < num_columns; ++j) {
+					if (winpos[i][j].valid != WindowPos::VALID) continue;
+					tops.push_back(winpos[i][j].top);
+					bottoms.push_back(winpos[i][j].bottom);
 				}
+				if (tops.empty()) continue;
+				std::nth_element(tops.begin(), tops.begin() + tops.size() / 2, tops.end());
+				std::nth_element(bottoms.begin(), bottoms.begin() + bottoms.size() / 2, bottoms.end());
+				floor_targets[i].top = tops[tops.size() / 2];
+				floor_targets[i].bottom = bottoms[bottoms.size() / 2];
 			}
 
-			// 全てのカラムの窓のY座標をそろえる
-			for (int c = 0; c < x_split.size() - 1; ++c) {
-				if (!winpos[i][c].valid) continue;
+			bool changed = false;
+			for (int i = 0; i < num_floors; ++i) {
+				for (int j = 0; j < num_columns; ++j) {
+					WindowPos& win = winpos[i][j];
+					if (win.valid != WindowPos::VALID) continue;
+
+					cv::Rect tile(x_split[j], y_split[i], x_split[j + 1] - x_split[j], y_split[i + 1] - y_split[i]);
+					if (win.left < 0 || win.top < 0 || win.left >= win.right || win.top >= win.bottom || win.right >= tile.width || win.bottom >= tile.height) continue;
+
+					WindowPos target(column_targets[j].left, floor_targets[i].top, column_targets[j].right, floor_targets[i].bottom);
+
+					// 各辺を、他の辺を固定して最適な位置に動かす
+					int* sides[4] = { &win.left, &win.right, &win.top, &win.bottom };
+					for (int s = 0; s < 4; ++s) {
+						int original = *sides[s];
+						int lo, hi;
+						if (s == 0) { lo = 0; hi = win.right - 1; }
+						else if (s == 1) { lo = win.left + 1; hi = tile.width - 1; }
+						else if (s == 2) { lo = 0; hi = win.bottom - 1; }
+						else { lo = win.top + 1; hi = tile.height - 1; }
+						lo = std::max(lo, original - radius);
+						hi = std::min(hi, original + radius);
+
+						int best = original;
+						float min_energy = computeEnergy(win, tile, edges, target, lambda);
+						for (int pos = lo; pos <= hi; ++pos) {
+							*sides[s] = pos;
+							float energy = computeEnergy(win, tile, edges, target, lambda);
+							if (energy < min_energy) {
+								min_energy = energy;
+								best = pos;
+							}
+						}
+						*sides[s] = best;
+						if (best != original) changed = true;
+					}
+				}
+			}
 
-				winpos[i][c].top = max_top;
-				winpos[i][c].bottom = max_bottom;
+			if (!changed) break;
+		}
+	}
+
+	/**
+	 * Find the local minima of a profile and their prominence in O(N).
+	 * The prominence of a minimum is the smaller one of the rises toward the left and the right,
+	 * where the rise is measured up to the nearest strictly smaller value (or the end of the profile).
+	 * isLocalMinimum(mat, index, threshold) is true iff the minimum at index has prominence > threshold.
+	 *
+	 * @param val		profile (column or row vector)
+	 * @param minima	[OUT] pairs of (index, prominence) in ascending order of index
+	 */
+	void findMinima(const cv::Mat_<float>& val, std::vector<std::pair<int, float>>& minima) {
+		minima.clear();
+
+		cv::Mat_<float> mat = val.isContinuous() ? val : val.clone();
+		int n = mat.total();
+		const float* v = mat.ptr<float>(0);
+
+		// for each direction, the highest value between each index and the nearest strictly smaller value
+		// is obtained by a monotonic stack of (index, highest value of the range covered by the index)
+		std::vector<float> rise[2];
+		for (int d = 0; d < 2; ++d) {
+			rise[d].assign(n, -std::numeric_limits<float>::infinity());
+			std::vector<std::pair<int, float>> stack;
+			for (int k = 0; k < n; ++k) {
+				int i = d == 0 ? k : n - 1 - k;
+				float highest = -std::numeric_limits<float>::infinity();
+				bool popped = false;
+				while (!stack.empty() && v[stack.back().first] >= v[i]) {
+					highest = std::max(highest, stack.back().second);
+					stack.pop_back();
+					popped = true;
+				}
+				if (popped) rise[d][i] = highest;
+				stack.push_back(std::make_pair(i, std::max(highest, v[i])));
+			}
+		}
+
+		for (int i = 0; i < n; ++i) {
+			float prominence = std::min(rise[0][i] - v[i], rise[1][i] - v[i]);
+			if (prominence >= 0) {
+				minima.push_back(std::make_pair(i, prominence));
 			}
 		}
 	}
@@ -2,6 +2,12 @@
 
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include "IntegralHistogram.h"
+#include "GradientIntegral.h"
+#include "EdgeIntegral.h"
+#include "TileClassifier.h"
+#include "MinimaHierarchy.h"
+#include "FacadeAnalysis.h"
 
 namespace fs {
 
@@ -20,22 +26,89 @@ namespace fs {
 		WindowPos(int left, int top, int right, int bottom) : left(left), top(top), right(right), bottom(bottom), valid(VALID) {}
 	};
 
+	class SymmetryOptions {
+	public:
+		int bins;		// number of intensity bins of the joint histogram (16, 32, 64, 128 or 256)
+		bool exact;		// true: the original float MI, false: MI by the n log n table
+		int num_threads;	// 0: OpenCV default, 1: single thread
+		bool prune;		// true: skip h whose upper bound min(H(R1), H(R2)) cannot beat the best MI so far
+		int pyramid_levels;	// 0: exhaustive search, n: coarse-to-fine search from the 1/2^n level
+		int top_k;		// number of candidates of h kept for each row at the coarse levels
+
+	public:
+		SymmetryOptions() : bins(256), exact(true), num_threads(0), prune(false), pyramid_levels(0), top_k(3) {}
+		SymmetryOptions(int bins, bool exact) : bins(bins), exact(exact), num_threads(0), prune(false), pyramid_levels(0), top_k(3) {}
+	};
+
+	class SymmetryStats {
+	public:
+		long long num_candidates;	// number of (r, h) pairs
+		long long num_pruned;		// number of (r, h) pairs skipped by the entropy bound
+		long long num_evaluated;	// number of (r, h) pairs whose MI is computed (at all pyramid levels)
+
+	public:
+		SymmetryStats() : num_candidates(0), num_pruned(0), num_evaluated(0) {}
+	};
+
+	class RefinementOptions {
+	public:
+		bool enabled;		// true: refineWindows is run after the window detection (and the alignment)
+		int max_iter;		// maximum number of coordinate descent iterations
+		float lambda;		// weight of the deviation from the column/floor medians (not tuned on testdata/ yet)
+		int radius;			// each side of a window moves within +/- radius pixels of its current position
+
+	public:
+		RefinementOptions() : enabled(false), max_iter(5), lambda(1.0f), radius(3) {}
+	};
+
+	class WindowOptions {
+	public:
+		bool skip_blank_tiles;		// true: skip the window detection on the tiles classified as blank by TileClassifier
+		bool group_tiles;			// true: detect the window once per tile type and map it to the other tiles of the type
+		float max_tile_distance;	// maximum distance (1 - correlation of the downsampled tiles) to the first tile of the type
+		int descriptor_size;		// tiles are downsampled to descriptor_size x descriptor_size to be compared
+		int refine_radius;			// each side of a mapped window is moved to the strongest edge within +/- refine_radius pixels
+		RefinementOptions refinement;	// energy-based refinement of the windows after the detection
+
+	public:
+		WindowOptions() : skip_blank_tiles(false), group_tiles(false), max_tile_distance(0.1f), descriptor_size(16), refine_radius(3) {}
+	};
+
 	void subdivideFacade(cv::Mat img, float floor_height, float column_width, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects);
+	void subdivideFacade(FacadeAnalysis& analysis, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects, const WindowOptions& options = WindowOptions(), TileStats* stats = NULL);
+	void subdivideFacade(cv::Mat img, bool align_windows, std::vector<float>& y_split, std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& win_rects);
 	std::vector<float> findBoundaries(const cv::Mat& img, cv::Range range1, cv::Range range2, int num_splits, const cv::Mat_<float>& Ver);
 	bool sortBySecondValue(const std::pair<float, float>& a, const std::pair<float, float>& b);
 	void sortByS(std::vector<float>& splits, std::map<int, float>& S_max);
 	void extractWindows(cv::Mat gray_img, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects);
+	void extractWindows(FacadeAnalysis& analysis, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, const WindowOptions& options = WindowOptions(), TileStats* stats = NULL);
+	void extractWindows(const GradientIntegral& grad, const EdgeIntegral& edges, const TileClassifier* classifier, bool skip_blank_tiles, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, TileStats* stats = NULL);
+	void extractWindowsByTileTypes(const cv::Mat& gray_img, const GradientIntegral& grad, const EdgeIntegral& edges, const TileClassifier* classifier, const std::vector<float>& y_splits, const std::vector<float>& x_splits, std::vector<std::vector<WindowPos>>& win_rects, const WindowOptions& options, TileStats* stats = NULL);
+	void groupTiles(const cv::Mat& gray_img, const std::vector<float>& y_splits, const std::vector<float>& x_splits, const std::vector<unsigned char>& excluded, float max_distance, int descriptor_size, std::vector<int>& types, std::vector<int>& representatives);
+	WindowPos mapWindow(const WindowPos& winpos, const cv::Rect& from, const cv::Rect& to, const EdgeIntegral& edges, int radius);
 	float MI(const cv::Mat& R1, const cv::Mat& R2);
-	void computeSV(const cv::Mat& img, cv::Mat_<float>& SV_max, cv::Mat_<int>& h_max, const cv::Range& h_range);
+	float MI(const cv::Mat& img, const IntegralHistogram& integral_hist, const cv::Rect& rect1, const cv::Rect& rect2);
+	void computeSV(const cv::Mat& img, cv::Mat_<float>& SV_max, cv::Mat_<int>& h_max, const cv::Range& h_range, const SymmetryOptions& options = SymmetryOptions(), SymmetryStats* stats = NULL);
 	void computeSV(const cv::Mat& img, int r, float& SV_max, int& h_max, const cv::Range& h_range);
-	void computeSH(const cv::Mat& img, cv::Mat_<float>& SH_max, cv::Mat_<int>& w_max, const cv::Range& w_range);
+	void computeSH(const cv::Mat& img, cv::Mat_<float>& SH_max, cv::Mat_<int>& w_max, const cv::Range& w_range, const SymmetryOptions& options = SymmetryOptions(), SymmetryStats* stats = NULL);
 	void computeSH(const cv::Mat& img, int c, float& SH_max, int& w_max, const cv::Range& w_range);
+	void reportSymmetryAccuracy(const cv::Mat& img, const cv::Range& h_range, const SymmetryOptions& options);
+	void reportJointHistogramSpeed(const cv::Mat& img);
 	void computeVerAndHor(const cv::Mat& img, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor, float sigma);
 	void computeVerAndHor2(const cv::Mat& img, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor, float alpha);
+	void computeVerAndHor2(const GradientIntegral& grad, const cv::Rect& rect, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor, float alpha);
+	void combineVerAndHor(const cv::Mat_<float>& sobelx_ver, const cv::Mat_<float>& sobelx_hor, const cv::Mat_<float>& sobely_ver, const cv::Mat_<float>& sobely_hor, float alpha, cv::Mat_<float>& Ver, cv::Mat_<float>& Hor);
+	void sumSobelMagnitude(const cv::Mat& gray, cv::Mat_<float>& x_rows, cv::Mat_<float>& x_cols, cv::Mat_<float>& y_rows, cv::Mat_<float>& y_cols);
+	float estimatePeriod(const cv::Mat_<float>& profile, float min_period, float max_period);
+	void estimateFloorHeightAndColumnWidth(const cv::Mat& img, float& floor_height, float& column_width);
 	void getSplitLines(const cv::Mat_<float>& mat, float threshold, std::vector<float>& split_positions);
+	void getSplitLines(const MinimaHierarchy& hierarchy, float threshold, std::vector<float>& split_positions);
 	void refineSplitLines(std::vector<float>& split_positions, float threshold);
 	void distributeSplitLines(std::vector<float>& split_positions, float threshold);
 	void align(const cv::Mat& edge_img, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, int max_iter);
+	float computeEnergy(const WindowPos& win, const cv::Rect& tile, const EdgeIntegral& edges, const WindowPos& target, float lambda);
+	void refineWindows(const EdgeIntegral& edges, const std::vector<float>& y_split, const std::vector<float>& x_split, std::vector<std::vector<WindowPos>>& winpos, int max_iter, float lambda, int radius);
+	void findMinima(const cv::Mat_<float>& val, std::vector<std::pair<int, float>>& minima);
 	bool isLocalMinimum(const cv::Mat& mat, int index, float threshold);
 
 	// visualization
@@ -0,0 +1,117 @@
+#include "GradientIntegral.h"
+#include "CVUtils.h"
+#include <opencv2/hal/intrin.hpp>
+
+namespace fs {
+
+	namespace {
+		int reflect101(int i, int n) {
+			if (n == 1) return 0;
+			if (i < 0) return -i;
+			if (i >= n) return n * 2 - 2 - i;
+			return i;
+		}
+	}
+
+	GradientIntegral::GradientIntegral() : rows(0), cols(0) {
+	}
+
+	/**
+	 * Compute the gradient magnitudes of the facade and their prefix sums.
+	 *
+	 * @param img		facade image (1-channel or 3-channel image)
+	 */
+	GradientIntegral::GradientIntegral(const cv::Mat& img) : rows(img.rows), cols(img.cols) {
+		cv::Mat gray;
+		cvutils::grayScale(img, gray);
+
+		x_row_table = cv::Mat_<int>(rows, cols + 1, 0);
+		y_row_table = cv::Mat_<int>(rows, cols + 1, 0);
+		x_col_table = cv::Mat_<int>(rows + 1, cols, 0);
+		y_col_table = cv::Mat_<int>(rows + 1, cols, 0);
+
+		std::vector<unsigned short> gx(cols), gy(cols);
+		for (int r = 0; r < rows; ++r) {
+			sobelMagnitudeRow(gray, r, &gx[0], &gy[0]);
+			int* x_row = x_row_table.ptr<int>(r);
+			int* y_row = y_row_table.ptr<int>(r);
+			const int* x_col_prev = x_col_table.ptr<int>(r);
+			const int* y_col_prev = y_col_table.ptr<int>(r);
+			int* x_col = x_col_table.ptr<int>(r + 1);
+			int* y_col = y_col_table.ptr<int>(r + 1);
+
+			for (int c = 0; c < cols; ++c) {
+				x_row[c + 1] = x_row[c] + gx[c];
+				y_row[c + 1] = y_row[c] + gy[c];
+				x_col[c] = x_col_prev[c] + gx[c];
+				y_col[c] = y_col_prev[c] + gy[c];
+			}
+		}
+	}
+
+	/**
+	 * Return the row sums and column sums of |Gx| and |Gy| inside the rectangle.
+	 *
+	 * @param rect		rectangle
+	 * @param x_rows	sum of |Gx| for each row (height x 1)
+	 * @param x_cols	sum of |Gx| for each column (1 x width)
+	 * @param y_rows	sum of |Gy| for each row (height x 1)
+	 * @param y_cols	sum of |Gy| for each column (1 x width)
+	 */
+	void GradientIntegral::sum(const cv::Rect& rect, cv::Mat_<float>& x_rows, cv::Mat_<float>& x_cols, cv::Mat_<float>& y_rows, cv::Mat_<float>& y_cols) const {
+		x_rows = cv::Mat_<float>(rect.height, 1);
+		y_rows = cv::Mat_<float>(rect.height, 1);
+		for (int r = 0; r < rect.height; ++r) {
+			x_rows(r, 0) = x_row_table(rect.y + r, rect.x + rect.width) - x_row_table(rect.y + r, rect.x);
+			y_rows(r, 0) = y_row_table(rect.y + r, rect.x + rect.width) - y_row_table(rect.y + r, rect.x);
+		}
+
+		x_cols = cv::Mat_<float>(1, rect.width);
+		y_cols = cv::Mat_<float>(1, rect.width);
+		for (int c = 0; c < rect.width; ++c) {
+			x_cols(0, c) = x_col_table(rect.y + rect.height, rect.x + c) - x_col_table(rect.y, rect.x + c);
+			y_cols(0, c) = y_col_table(rect.y + rect.height, rect.x + c) - y_col_table(rect.y, rect.x + c);
+		}
+	}
+
+	/**
+	 * Compute the 3x3 Sobel gradient magnitudes |Gx| and |Gy| of one row.
+	 * The border pixels are reflected in the same way as cv::Sobel (BORDER_REFLECT_101),
+	 * and each magnitude is at most 4 x 255, so it fits in 16 bits.
+	 *
+	 * @param gray		image (1-channel 8-bit image)
+	 * @param r			row
+	 * @param gx		[OUT] |Gx| of each pixel of the row (gray.cols elements)
+	 * @param gy		[OUT] |Gy| of each pixel of the row (gray.cols elements)
+	 */
+	void sobelMagnitudeRow(const cv::Mat& gray, int r, unsigned short* gx, unsigned short* gy) {
+		int cols = gray.cols;
+		const unsigned char* p0 = gray.ptr<unsigned char>(reflect101(r - 1, gray.rows));
+		const unsigned char* p1 = gray.ptr<unsigned char>(r);
+		const unsigned char* p2 = gray.ptr<unsigned char>(reflect101(r + 1, gray.rows));
+
+		auto pixel = [&](int c) {
+			int cl = reflect101(c - 1, cols);
+			int cr = reflect101(c + 1, cols);
+			gx[c] = std::abs((p0[cr] + p1[cr] * 2 + p2[cr]) - (p0[cl] + p1[cl] * 2 + p2[cl]));
+			gy[c] = std::abs((p2[cl] + p2[c] * 2 + p2[cr]) - (p0[cl] + p0[c] * 2 + p0[cr]));
+		};
+
+		pixel(0);
+		int c = 1;
+#if CV_SIMD128
+		// 8 interior pixels at a time
+		for (; c + 8 < cols; c += 8) {
+			cv::v_uint16x8 a0 = cv::v_load_expand(p0 + c - 1), a1 = cv::v_load_expand(p0 + c), a2 = cv::v_load_expand(p0 + c + 1);
+			cv::v_uint16x8 b0 = cv::v_load_expand(p1 + c - 1), b2 = cv::v_load_expand(p1 + c + 1);
+			cv::v_uint16x8 c0 = cv::v_load_expand(p2 + c - 1), c1 = cv::v_load_expand(p2 + c), c2 = cv::v_load_expand(p2 + c + 1);
+			cv::v_store(gx + c, cv::v_absdiff(a2 + b2 + b2 + c2, a0 + b0 + b0 + c0));
+			cv::v_store(gy + c, cv::v_absdiff(c0 + c1 + c1 + c2, a0 + a1 + a1 + a2));
+		}
+#endif
+		for (; c < cols; ++c) {
+			pixel(c);
+		}
+	}
+
+}
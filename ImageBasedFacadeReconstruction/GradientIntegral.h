@@ -0,0 +1,32 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+namespace fs {
+
+	/**
+	 * Prefix sums of the 3x3 Sobel gradient magnitudes |Gx| and |Gy| of a whole facade.
+	 * The gradients are computed once with the facade-wide neighbors (BORDER_REFLECT_101 only at the facade border),
+	 * and the row sums and column sums of |Gx| and |Gy| inside any tile are obtained in O(h + w).
+	 */
+	class GradientIntegral {
+	private:
+		int rows;
+		int cols;
+		cv::Mat_<int> x_row_table;	// rows x (cols + 1): sum of |Gx| of the columns [0, c) in each row
+		cv::Mat_<int> y_row_table;	// rows x (cols + 1): sum of |Gy| of the columns [0, c) in each row
+		cv::Mat_<int> x_col_table;	// (rows + 1) x cols: sum of |Gx| of the rows [0, r) in each column
+		cv::Mat_<int> y_col_table;	// (rows + 1) x cols: sum of |Gy| of the rows [0, r) in each column
+
+	public:
+		GradientIntegral();
+		GradientIntegral(const cv::Mat& img);
+
+		int numRows() const { return rows; }
+		int numCols() const { return cols; }
+		void sum(const cv::Rect& rect, cv::Mat_<float>& x_rows, cv::Mat_<float>& x_cols, cv::Mat_<float>& y_rows, cv::Mat_<float>& y_cols) const;
+	};
+
+	void sobelMagnitudeRow(const cv::Mat& gray, int r, unsigned short* gx, unsigned short* gy);
+
+}
@@ -0,0 +1,124 @@
+#include "IntegralHistogram.h"
+
+namespace fs {
+
+	IntegralHistogram::IntegralHistogram() : bins(0), shift(0), rows(0), cols(0) {
+	}
+
+	/**
+	 * Build the integral histogram.
+	 *
+	 * @param img				image (1-channel 8-bit image)
+	 * @param bins				number of intensity bins (16, 32, 64, 128 or 256)
+	 * @param build_rect_table	true if the histograms of arbitrary rectangles are needed
+	 */
+	IntegralHistogram::IntegralHistogram(const cv::Mat& img, int bins, bool build_rect_table) : bins(bins), rows(img.rows), cols(img.cols) {
+		// the bins are indexed by the upper bits of the intensity, so it must be a power of two up to 256
+		CV_Assert(bins >= 2 && bins <= 256 && (bins & (bins - 1)) == 0);
+
+		int bits = 0;
+		while ((1 << bits) < bins) bits++;
+		shift = 8 - bits;
+
+		// cumulative histograms of the rows
+		row_table.resize((rows + 1) * bins, 0);
+		for (int r = 0; r < rows; ++r) {
+			const unsigned char* p = img.ptr<unsigned char>(r);
+			int* prev = &row_table[r * bins];
+			int* cur = &row_table[(r + 1) * bins];
+			for (int k = 0; k < bins; ++k) {
+				cur[k] = prev[k];
+			}
+			for (int c = 0; c < cols; ++c) {
+				cur[p[c] >> shift]++;
+			}
+		}
+
+		// cumulative histograms of the columns
+		col_table.resize((cols + 1) * bins, 0);
+		for (int r = 0; r < rows; ++r) {
+			const unsigned char* p = img.ptr<unsigned char>(r);
+			for (int c = 0; c < cols; ++c) {
+				col_table[(c + 1) * bins + (p[c] >> shift)]++;
+			}
+		}
+		for (int c = 0; c < cols; ++c) {
+			int* prev = &col_table[c * bins];
+			int* cur = &col_table[(c + 1) * bins];
+			for (int k = 0; k < bins; ++k) {
+				cur[k] += prev[k];
+			}
+		}
+
+		// cumulative histograms of the rectangles [0, r) x [0, c)
+		if (build_rect_table) {
+			int stride = (cols + 1) * bins;
+			rect_table.resize((rows + 1) * stride, 0);
+			std::vector<int> row_hist(bins);
+			for (int r = 0; r < rows; ++r) {
+				const unsigned char* p = img.ptr<unsigned char>(r);
+				std::fill(row_hist.begin(), row_hist.end(), 0);
+				const int* prev = &rect_table[r * stride];
+				int* cur = &rect_table[(r + 1) * stride];
+				for (int c = 0; c < cols; ++c) {
+					row_hist[p[c] >> shift]++;
+					for (int k = 0; k < bins; ++k) {
+						cur[(c + 1) * bins + k] = prev[(c + 1) * bins + k] + row_hist[k];
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * Return the histogram of the rows [r1, r2).
+	 */
+	void IntegralHistogram::rowBand(int r1, int r2, int* hist) const {
+		const int* p1 = &row_table[r1 * bins];
+		const int* p2 = &row_table[r2 * bins];
+		for (int k = 0; k < bins; ++k) {
+			hist[k] = p2[k] - p1[k];
+		}
+	}
+
+	/**
+	 * Return the histogram of the columns [c1, c2).
+	 */
+	void IntegralHistogram::colBand(int c1, int c2, int* hist) const {
+		const int* p1 = &col_table[c1 * bins];
+		const int* p2 = &col_table[c2 * bins];
+		for (int k = 0; k < bins; ++k) {
+			hist[k] = p2[k] - p1[k];
+		}
+	}
+
+	/**
+	 * Return the histogram of the rectangle.
+	 * The full-width and full-height rectangles are served by the band tables,
+	 * and the others need the rectangle table.
+	 *
+	 * @param rect		rectangle
+	 * @param hist		histogram (bins elements)
+	 */
+	void IntegralHistogram::histogram(const cv::Rect& rect, int* hist) const {
+		if (rect.x == 0 && rect.width == cols) {
+			rowBand(rect.y, rect.y + rect.height, hist);
+		}
+		else if (rect.y == 0 && rect.height == rows) {
+			colBand(rect.x, rect.x + rect.width, hist);
+		}
+		else {
+			CV_Assert(!rect_table.empty());
+
+			int stride = (cols + 1) * bins;
+			const int* p11 = &rect_table[rect.y * stride + rect.x * bins];
+			const int* p12 = &rect_table[rect.y * stride + (rect.x + rect.width) * bins];
+			const int* p21 = &rect_table[(rect.y + rect.height) * stride + rect.x * bins];
+			const int* p22 = &rect_table[(rect.y + rect.height) * stride + (rect.x + rect.width) * bins];
+			for (int k = 0; k < bins; ++k) {
+				hist[k] = p22[k] - p21[k] - p12[k] + p11[k];
+			}
+		}
+	}
+
+}
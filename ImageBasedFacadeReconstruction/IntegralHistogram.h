@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace fs {
+
+	/**
+	 * Integral histogram of a 1-channel 8-bit image.
+	 * The intensity histogram of any row band, column band or (optionally) rectangle
+	 * is obtained in O(bins) by subtracting cumulative histograms.
+	 * The rectangle table needs (rows + 1) x (cols + 1) x bins integers, so it is built only on request.
+	 */
+	class IntegralHistogram {
+	private:
+		int bins;
+		int shift;
+		int rows;
+		int cols;
+		std::vector<int> row_table;		// (rows + 1) x bins: histogram of the rows [0, r)
+		std::vector<int> col_table;		// (cols + 1) x bins: histogram of the columns [0, c)
+		std::vector<int> rect_table;	// (rows + 1) x (cols + 1) x bins: histogram of [0, r) x [0, c)
+
+	public:
+		IntegralHistogram();
+		IntegralHistogram(const cv::Mat& img, int bins = 256, bool build_rect_table = false);
+
+		int numBins() const { return bins; }
+		bool hasRectTable() const { return !rect_table.empty(); }
+		void rowBand(int r1, int r2, int* hist) const;
+		void colBand(int c1, int c2, int* hist) const;
+		void histogram(const cv::Rect& rect, int* hist) const;
+	};
+
+}
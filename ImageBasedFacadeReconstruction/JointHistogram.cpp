@@ -0,0 +1,326 @@
+#include "JointHistogram.h"
+#include <math.h>
+#include <algorithm>
+#include <opencv2/core.hpp>
+#include <opencv2/hal/intrin.hpp>
+
+namespace fs {
+
+	const double JointHistogram::NLOGN_SCALE = 1048576.0;
+
+	/**
+	 * @param bins			number of intensity bins (16, 32, 64, 128 or 256)
+	 * @param marginals		true if the marginal histograms are also counted
+	 */
+	JointHistogram::JointHistogram(int bins, bool marginals) : bins(bins), marginals(marginals), total(0) {
+		// the bins are indexed by the upper bits of the intensity, so it must be a power of two up to 256
+		CV_Assert(bins >= 2 && bins <= 256 && (bins & (bins - 1)) == 0);
+
+		bits = 0;
+		while ((1 << bits) < bins) bits++;
+		shift = 8 - bits;
+
+		Pab.resize(bins * bins, 0);
+		Pa.resize(bins, 0);
+		Pb.resize(bins, 0);
+		cell_pos.resize(bins * bins, -1);
+		cells.reserve(bins * bins);
+	}
+
+	void JointHistogram::clear() {
+		for (int i = 0; i < cells.size(); ++i) {
+			Pab[cells[i]] = 0;
+			cell_pos[cells[i]] = -1;
+		}
+		cells.clear();
+		std::fill(Pa.begin(), Pa.end(), 0);
+		std::fill(Pb.begin(), Pb.end(), 0);
+		total = 0;
+	}
+
+	/**
+	 * Add n pixel pairs (a[i], b[i]) to the histogram.
+	 *
+	 * @param a		pixels of region 1
+	 * @param b		pixels of region 2
+	 * @param n		number of pixels
+	 */
+	void JointHistogram::add(const unsigned char* a, const unsigned char* b, int n) {
+		const unsigned short* index = packIndices(a, b, n);
+		int mask = (1 << bits) - 1;
+		for (int i = 0; i < n; ++i) {
+			if (Pab[index[i]]++ == 0) {
+				cell_pos[index[i]] = cells.size();
+				cells.push_back(index[i]);
+			}
+			if (marginals) {
+				Pa[index[i] >> bits]++;
+				Pb[index[i] & mask]++;
+			}
+		}
+		total += n;
+
+		if (total >= (int)nlogn.size()) {
+			updateTable(total);
+		}
+	}
+
+	/**
+	 * Remove n pixel pairs (a[i], b[i]) that were added before.
+	 *
+	 * @param a		pixels of region 1
+	 * @param b		pixels of region 2
+	 * @param n		number of pixels
+	 */
+	void JointHistogram::remove(const unsigned char* a, const unsigned char* b, int n) {
+		const unsigned short* index = packIndices(a, b, n);
+		int mask = (1 << bits) - 1;
+		for (int i = 0; i < n; ++i) {
+			if (--Pab[index[i]] == 0) {
+				// swap the last cell into the slot of the emptied one
+				int pos = cell_pos[index[i]];
+				int last = cells.back();
+				cells[pos] = last;
+				cell_pos[last] = pos;
+				cells.pop_back();
+				cell_pos[index[i]] = -1;
+			}
+			if (marginals) {
+				Pa[index[i] >> bits]--;
+				Pb[index[i] & mask]--;
+			}
+		}
+		total -= n;
+	}
+
+	/**
+	 * Add the pixel pairs of two regions of rows x cols pixels.
+	 * Neighboring pixels of a facade often have the same intensity, so incrementing one histogram
+	 * would make each increment wait for the store of the previous one.
+	 * Instead, the pixels are distributed to 4 interleaved sub-histograms in turn, which are merged at the end.
+	 * Merging visits the rows of the joint histogram that have been hit, so small regions are added to the histogram directly.
+	 *
+	 * @param a			pixels of region 1
+	 * @param a_step	number of bytes between the rows of region 1
+	 * @param b			pixels of region 2
+	 * @param b_step	number of bytes between the rows of region 2
+	 * @param rows		number of rows
+	 * @param cols		number of columns
+	 */
+	void JointHistogram::addRows(const unsigned char* a, int a_step, const unsigned char* b, int b_step, int rows, int cols) {
+		if (rows * cols < bins * 16) {
+			for (int r = 0; r < rows; ++r) {
+				add(a + r * a_step, b + r * b_step, cols);
+			}
+			return;
+		}
+
+		if (sub_hist.empty()) {
+			sub_hist.resize(bins * bins * 4, 0);
+			dirty_rows.resize(bins, 0);
+		}
+
+		// each lane receives at most (cols + 3) / 4 pixels per row, and it is merged before it can overflow 16 bits
+		int lane_max = (cols + 3) / 4;
+		int lane_count = 0;
+		for (int r = 0; r < rows; ++r) {
+			if (lane_count + lane_max > 65535) {
+				mergeSubHistograms();
+				lane_count = 0;
+			}
+
+			const unsigned short* index = packIndices(a + r * a_step, b + r * b_step, cols);
+			unsigned short* h = &sub_hist[0];
+			unsigned char* dirty = &dirty_rows[0];
+			int c = 0;
+			for (; c <= cols - 4; c += 4) {
+				h[index[c] * 4]++;
+				h[index[c + 1] * 4 + 1]++;
+				h[index[c + 2] * 4 + 2]++;
+				h[index[c + 3] * 4 + 3]++;
+				dirty[index[c] >> bits] = 1;
+				dirty[index[c + 1] >> bits] = 1;
+				dirty[index[c + 2] >> bits] = 1;
+				dirty[index[c + 3] >> bits] = 1;
+			}
+			for (; c < cols; ++c) {
+				h[index[c] * 4 + (c & 3)]++;
+				dirty[index[c] >> bits] = 1;
+			}
+			lane_count += lane_max;
+		}
+		mergeSubHistograms();
+
+		total += rows * cols;
+
+		if (total >= (int)nlogn.size()) {
+			updateTable(total);
+		}
+	}
+
+	/**
+	 * Return the mutual information of the two regions.
+	 */
+	float JointHistogram::MI() const {
+		return MI(&Pa[0], &Pb[0]);
+	}
+
+	/**
+	 * Return the mutual information of the two regions using the given marginal histograms.
+	 * The arithmetic follows the original float implementation step by step
+	 * (normalization by the reciprocal of the total, the same clamping and the same summation order)
+	 * so that the result is identical to it. The empty cells contribute exactly zero, so they are skipped.
+	 *
+	 * @param Pa	histogram of region 1
+	 * @param Pb	histogram of region 2
+	 * @return		mutual information
+	 */
+	float JointHistogram::MI(const int* Pa, const int* Pb) const {
+		float scale = (float)(1.0 / total);
+
+		float result = 0.0f;
+		for (int a = 0; a < bins; ++a) {
+			if (Pa[a] == 0) continue;
+
+			float v1 = Pa[a] * scale;
+			for (int b = 0; b < bins; ++b) {
+				int n = Pab[(a << bits) | b];
+				if (n == 0) continue;
+
+				float v = n * scale;
+				float v2 = Pb[b] * scale;
+				result += v * log(v / v1 / v2);
+			}
+		}
+
+		return result;
+	}
+
+	/**
+	 * Return the mutual information using the n log n table.
+	 */
+	float JointHistogram::fastMI() const {
+		return fastMI(&Pa[0], &Pb[0]);
+	}
+
+	/**
+	 * Return the mutual information using the n log n table and the given marginal histograms.
+	 * MI = log N + (sum n_ab log n_ab - sum n_a log n_a - sum n_b log n_b) / N,
+	 * where only the occupied cells of the joint histogram are visited.
+	 * The sums are accumulated in fixed point, so the result does not depend on the order of the cells.
+	 *
+	 * @param Pa	histogram of region 1
+	 * @param Pb	histogram of region 2
+	 * @return		mutual information
+	 */
+	float JointHistogram::fastMI(const int* Pa, const int* Pb) const {
+		if (total == 0) return 0.0f;
+
+		long long sum = 0;
+		for (int i = 0; i < cells.size(); ++i) {
+			sum += nlogn[Pab[cells[i]]];
+		}
+		for (int i = 0; i < bins; ++i) {
+			sum -= nlogn[Pa[i]];
+			sum -= nlogn[Pb[i]];
+		}
+
+		return (float)(log((double)total) + sum / NLOGN_SCALE / total);
+	}
+
+	/**
+	 * Return the entropy of a histogram of the same quantization using the n log n table.
+	 * H = log N - sum n_i log n_i / N, which bounds the mutual information from above.
+	 *
+	 * @param P		histogram (bins elements)
+	 * @param n		sum of the histogram
+	 * @return		entropy
+	 */
+	float JointHistogram::entropy(const int* P, int n) {
+		if (n == 0) return 0.0f;
+		if (n >= (int)nlogn.size()) {
+			updateTable(n);
+		}
+
+		long long sum = 0;
+		for (int i = 0; i < bins; ++i) {
+			sum += nlogn[P[i]];
+		}
+
+		return (float)(log((double)n) - sum / NLOGN_SCALE / n);
+	}
+
+	/**
+	 * Extend the n log n table so that it covers the count n.
+	 */
+	void JointHistogram::updateTable(int n) {
+		int size = std::max(n + 1, (int)nlogn.size() * 2);
+		int start = nlogn.size();
+		nlogn.resize(size);
+		for (int i = start; i < size; ++i) {
+			nlogn[i] = i <= 1 ? 0 : (long long)(i * log((double)i) * NLOGN_SCALE + 0.5);
+		}
+	}
+
+	/**
+	 * Pack n pixel pairs into the 16-bit indices (a[i] >> shift) << bits | (b[i] >> shift).
+	 * 16 pairs are packed at a time with the universal intrinsics of OpenCV.
+	 *
+	 * @param a		pixels of region 1
+	 * @param b		pixels of region 2
+	 * @param n		number of pixels
+	 * @return		indices (valid until the next call)
+	 */
+	const unsigned short* JointHistogram::packIndices(const unsigned char* a, const unsigned char* b, int n) {
+		if ((int)index_buf.size() < n + 1) {
+			index_buf.resize(n + 1);
+		}
+		unsigned short* index = &index_buf[0];
+
+		int i = 0;
+#if CV_SIMD128
+		for (; i <= n - 16; i += 16) {
+			cv::v_uint16x8 a0, a1, b0, b1;
+			cv::v_expand(cv::v_load(a + i), a0, a1);
+			cv::v_expand(cv::v_load(b + i), b0, b1);
+			cv::v_store(index + i, ((a0 >> shift) << bits) | (b0 >> shift));
+			cv::v_store(index + i + 8, ((a1 >> shift) << bits) | (b1 >> shift));
+		}
+#endif
+		for (; i < n; ++i) {
+			index[i] = ((a[i] >> shift) << bits) | (b[i] >> shift);
+		}
+
+		return index;
+	}
+
+	/**
+	 * Add the counts of the sub-histograms to the histogram and clear them.
+	 * Only the rows of the joint histogram (intensities of region 1) that have been hit are visited.
+	 */
+	void JointHistogram::mergeSubHistograms() {
+		for (int qa = 0; qa < bins; ++qa) {
+			if (!dirty_rows[qa]) continue;
+			dirty_rows[qa] = 0;
+
+			unsigned short* h = &sub_hist[(qa << bits) * 4];
+			for (int qb = 0; qb < bins; ++qb, h += 4) {
+				int n = h[0] + h[1] + h[2] + h[3];
+				if (n == 0) continue;
+
+				h[0] = h[1] = h[2] = h[3] = 0;
+				int i = (qa << bits) | qb;
+				if (Pab[i] == 0) {
+					cell_pos[i] = cells.size();
+					cells.push_back(i);
+				}
+				Pab[i] += n;
+				if (marginals) {
+					Pa[qa] += n;
+					Pb[qb] += n;
+				}
+			}
+		}
+	}
+
+}
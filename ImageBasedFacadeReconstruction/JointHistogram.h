@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+namespace fs {
+
+	/**
+	 * Joint intensity histogram of pixel pairs (a, b) taken from two regions of the same size.
+	 * The counts are kept as integers so that rows of pixel pairs can be added and removed,
+	 * which allows a window to be slid over the image without rebuilding the histogram.
+	 * The intensities can be quantized into 16, 32, 64, 128 or 256 bins.
+	 * The marginal histograms can be left out and given to MI() / fastMI() from an IntegralHistogram instead.
+	 * The pixel pairs are packed into 16-bit indices with SIMD, and a whole region is counted by addRows()
+	 * into interleaved sub-histograms so that the increments of neighboring pixels do not depend on each other.
+	 */
+	class JointHistogram {
+	private:
+		int bins;
+		int shift;
+		int bits;
+		bool marginals;
+		std::vector<int> Pab;
+		std::vector<int> Pa;
+		std::vector<int> Pb;
+		int total;
+
+		// list of the occupied cells of Pab and the position of each cell in the list (-1 if empty)
+		std::vector<int> cells;
+		std::vector<int> cell_pos;
+
+		// n log n table in fixed point (scaled by NLOGN_SCALE)
+		std::vector<long long> nlogn;
+
+		// packed 16-bit indices (qa << bits | qb) of one row of pixel pairs
+		std::vector<unsigned short> index_buf;
+
+		// 4 interleaved 16-bit sub-histograms (cell * 4 + lane) used by addRows()
+		std::vector<unsigned short> sub_hist;
+		std::vector<unsigned char> dirty_rows;
+
+	public:
+		static const double NLOGN_SCALE;
+
+	public:
+		JointHistogram(int bins = 256, bool marginals = true);
+
+		void clear();
+		void add(const unsigned char* a, const unsigned char* b, int n);
+		void remove(const unsigned char* a, const unsigned char* b, int n);
+		void addRows(const unsigned char* a, int a_step, const unsigned char* b, int b_step, int rows, int cols);
+		int count() const { return total; }
+		int numBins() const { return bins; }
+		int numOccupiedCells() const { return (int)cells.size(); }
+		float MI() const;
+		float MI(const int* Pa, const int* Pb) const;
+		float fastMI() const;
+		float fastMI(const int* Pa, const int* Pb) const;
+		float entropy(const int* P, int n);
+
+	private:
+		void updateTable(int n);
+		const unsigned short* packIndices(const unsigned char* a, const unsigned char* b, int n);
+		void mergeSubHistograms();
+	};
+
+}
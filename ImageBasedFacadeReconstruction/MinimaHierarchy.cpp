@@ -0,0 +1,56 @@
+#include "MinimaHierarchy.h"
+#include "FacadeSegmentation.h"
+#include <algorithm>
+
+namespace fs {
+
+	namespace {
+		bool isMoreProminent(const std::pair<int, float>& a, const std::pair<int, float>& b) {
+			if (a.second != b.second) return a.second > b.second;
+			return a.first < b.first;
+		}
+	}
+
+	MinimaHierarchy::MinimaHierarchy() : length(0), value_range(0) {
+	}
+
+	/**
+	 * Find the minima of the profile and sort them by prominence.
+	 *
+	 * @param profile	profile (column or row vector)
+	 */
+	MinimaHierarchy::MinimaHierarchy(const cv::Mat_<float>& profile) : length(profile.total()) {
+		double max_value, min_value;
+		cv::minMaxLoc(profile, &min_value, &max_value);
+		value_range = max_value - min_value;
+
+		findMinima(profile, minima);
+		std::sort(minima.begin(), minima.end(), isMoreProminent);
+	}
+
+	/**
+	 * Return the number of minima whose prominence exceeds the threshold.
+	 *
+	 * @param threshold		threshold relative to the range of the profile (same as getSplitLines)
+	 */
+	int MinimaHierarchy::numMinima(float threshold) const {
+		threshold *= value_range;
+		return std::partition_point(minima.begin(), minima.end(), [threshold](const std::pair<int, float>& m) { return m.second > threshold; }) - minima.begin();
+	}
+
+	/**
+	 * Return the indices of the minima whose prominence exceeds the threshold in ascending order.
+	 *
+	 * @param threshold		threshold relative to the range of the profile (same as getSplitLines)
+	 * @param indices		[OUT] indices of the minima
+	 */
+	void MinimaHierarchy::minimaAbove(float threshold, std::vector<int>& indices) const {
+		int n = numMinima(threshold);
+		indices.resize(n);
+		for (int i = 0; i < n; ++i) {
+			indices[i] = minima[i].first;
+		}
+		std::sort(indices.begin(), indices.end());
+	}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace fs {
+
+	/**
+	 * Persistence hierarchy of the local minima of a profile (e.g. Ver or Hor).
+	 * The minima and their prominence are computed once, and kept in descending order of prominence,
+	 * so that the minima whose prominence exceeds any threshold are obtained as a prefix of the list.
+	 * This makes a sweep over many thresholds as cheap as walking over the list.
+	 */
+	class MinimaHierarchy {
+	private:
+		int length;
+		double value_range;
+		std::vector<std::pair<int, float>> minima;	// (index, prominence) in descending order of prominence
+
+	public:
+		MinimaHierarchy();
+		MinimaHierarchy(const cv::Mat_<float>& profile);
+
+		int numSamples() const { return length; }
+		int numMinima(float threshold) const;
+		void minimaAbove(float threshold, std::vector<int>& indices) const;
+	};
+
+}
@@ -0,0 +1,162 @@
+#include "SymmetryCache.h"
+#include <fstream>
+#include <algorithm>
+#include <ctime>
+#include <cstdio>
+#include <boost/filesystem.hpp>
+
+namespace fs {
+
+	namespace {
+		const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+		const unsigned long long FNV_PRIME = 1099511628211ULL;
+		const int MAGIC = 0x31435346;	// "FSC1"
+
+		void hashBytes(const void* data, size_t size, unsigned long long& hash) {
+			const unsigned char* p = (const unsigned char*)data;
+			for (size_t i = 0; i < size; ++i) {
+				hash ^= p[i];
+				hash *= FNV_PRIME;
+			}
+		}
+	}
+
+	/**
+	 * @param dir			cache directory (created if it does not exist)
+	 * @param max_entries	maximum number of entries
+	 */
+	SymmetryCache::SymmetryCache(const std::string& dir, int max_entries) : dir(dir), max_entries(max_entries) {
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(dir, ec);
+	}
+
+	/**
+	 * Return the key of the image and the parameters (64-bit FNV-1a hash in hex).
+	 * CACHE_VERSION is also hashed, so the entries of an older version are never reused.
+	 *
+	 * @param img		image
+	 * @param params	parameters that affect the cached values
+	 * @return			key
+	 */
+	std::string SymmetryCache::computeKey(const cv::Mat& img, const std::vector<int>& params) {
+		unsigned long long hash = FNV_OFFSET;
+
+		int header[4] = { CACHE_VERSION, img.rows, img.cols, img.type() };
+		hashBytes(header, sizeof(header), hash);
+		for (int r = 0; r < img.rows; ++r) {
+			hashBytes(img.ptr(r), img.cols * img.elemSize(), hash);
+		}
+		if (params.size() > 0) {
+			hashBytes(&params[0], params.size() * sizeof(int), hash);
+		}
+
+		char key[17];
+		sprintf(key, "%016llx", hash);
+		return key;
+	}
+
+	/**
+	 * Load the matrices of the entry.
+	 * The entry is rejected unless it has exactly sizes.size() matrices, and each of them is a CV_32F or CV_32S matrix
+	 * of the expected size or an empty matrix, so a corrupted or foreign file is never handed out.
+	 * The entry becomes the most recently used one.
+	 *
+	 * @param key		key
+	 * @param sizes		expected size of each matrix
+	 * @param mats		matrices
+	 * @return			true if a valid entry is found
+	 */
+	bool SymmetryCache::load(const std::string& key, const std::vector<cv::Size>& sizes, std::vector<cv::Mat>& mats) {
+		std::ifstream in(filename(key).c_str(), std::ios::binary);
+		if (!in.good()) return false;
+
+		int magic = 0;
+		int num_mats = 0;
+		in.read((char*)&magic, sizeof(int));
+		in.read((char*)&num_mats, sizeof(int));
+		if (!in.good() || magic != MAGIC) return false;
+		if (num_mats <= 0 || num_mats > MAX_MATS || num_mats != (int)sizes.size()) return false;
+
+		std::vector<cv::Mat> loaded(num_mats);
+		for (int i = 0; i < num_mats; ++i) {
+			int header[3];
+			in.read((char*)header, sizeof(header));
+			if (!in.good()) return false;
+
+			int rows = header[0];
+			int cols = header[1];
+			int type = header[2];
+			if (rows == 0 && cols == 0) continue;
+			if (rows != sizes[i].height || cols != sizes[i].width) return false;
+			if (type != CV_32F && type != CV_32S) return false;
+
+			loaded[i].create(rows, cols, type);
+			for (int r = 0; r < rows; ++r) {
+				in.read((char*)loaded[i].ptr(r), loaded[i].cols * loaded[i].elemSize());
+			}
+			if (!in.good()) return false;
+		}
+		in.close();
+		mats.swap(loaded);
+
+		// update the time stamp for LRU eviction
+		boost::system::error_code ec;
+		boost::filesystem::last_write_time(filename(key), std::time(NULL), ec);
+
+		return true;
+	}
+
+	/**
+	 * Save the matrices as the entry.
+	 * The file is written to a temporary name and renamed, so an interrupted run does not leave a broken entry.
+	 *
+	 * @param key		key
+	 * @param mats		matrices
+	 */
+	void SymmetryCache::save(const std::string& key, const std::vector<cv::Mat>& mats) {
+		std::string tmp_filename = filename(key) + ".tmp";
+		std::ofstream out(tmp_filename.c_str(), std::ios::binary);
+		if (!out.good()) return;
+
+		int num_mats = mats.size();
+		out.write((const char*)&MAGIC, sizeof(int));
+		out.write((const char*)&num_mats, sizeof(int));
+		for (int i = 0; i < num_mats; ++i) {
+			int header[3] = { mats[i].rows, mats[i].cols, mats[i].type() };
+			out.write((const char*)header, sizeof(header));
+			for (int r = 0; r < mats[i].rows; ++r) {
+				out.write((const char*)mats[i].ptr(r), mats[i].cols * mats[i].elemSize());
+			}
+		}
+		out.close();
+
+		boost::system::error_code ec;
+		boost::filesystem::remove(filename(key), ec);
+		boost::filesystem::rename(tmp_filename, filename(key), ec);
+
+		evict();
+	}
+
+	std::string SymmetryCache::filename(const std::string& key) const {
+		return (boost::filesystem::path(dir) / (key + ".bin")).string();
+	}
+
+	/**
+	 * Remove the least recently used entries so that at most max_entries entries remain.
+	 */
+	void SymmetryCache::evict() {
+		std::vector<std::pair<std::time_t, boost::filesystem::path> > entries;
+		boost::system::error_code ec;
+		for (auto it = boost::filesystem::directory_iterator(dir, ec); it != boost::filesystem::directory_iterator(); ++it) {
+			if (it->path().extension() != ".bin") continue;
+			entries.push_back(std::make_pair(boost::filesystem::last_write_time(it->path(), ec), it->path()));
+		}
+		if (entries.size() <= max_entries) return;
+
+		std::sort(entries.begin(), entries.end());
+		for (int i = 0; i < (int)entries.size() - max_entries; ++i) {
+			boost::filesystem::remove(entries[i].second, ec);
+		}
+	}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+namespace fs {
+
+	/**
+	 * Binary cache of the symmetry profiles (S_max, h_max, Ver, Hor, etc.) of facade images.
+	 * Each entry is keyed by a hash of CACHE_VERSION, the image bytes and the parameters passed by the caller
+	 * (blur kernel, h/w ranges, symmetry options, etc.). A parameter that is not passed is not part of the key,
+	 * and a change of the symmetry code is detected only if CACHE_VERSION is bumped.
+	 * The entries are stored as raw binary files in the cache directory, and the least recently used ones
+	 * are removed when the number of entries exceeds max_entries.
+	 */
+	class SymmetryCache {
+	private:
+		std::string dir;
+		int max_entries;
+
+	public:
+		// bump this whenever the computation of the cached values or the file format changes
+		static const int CACHE_VERSION = 2;
+		static const int MAX_MATS = 16;
+
+	public:
+		SymmetryCache(const std::string& dir, int max_entries = 256);
+
+		static std::string computeKey(const cv::Mat& img, const std::vector<int>& params);
+		bool load(const std::string& key, const std::vector<cv::Size>& sizes, std::vector<cv::Mat>& mats);
+		void save(const std::string& key, const std::vector<cv::Mat>& mats);
+
+	private:
+		std::string filename(const std::string& key) const;
+		void evict();
+	};
+
+}
@@ -1,6 +1,7 @@
 ﻿#include "Utils.h"
 #include <math.h>
 #include <algorithm>
+#include <mutex>
 
 namespace utils {
 	const float M_PI = 3.1415926535;
@@ -9,6 +10,83 @@ namespace utils {
 		return 1.0f / 2.0f / M_PI / sigma / sigma * expf(-u * u / 2.0f / sigma / sigma);
 	}
 
+	// cached tables of GaussianKernel
+	// (at most MAX_CACHED_KERNELS sigmas are kept; the tables held by the instances survive the clear)
+	static const int MAX_CACHED_KERNELS = 16;
+	static std::map<float, std::shared_ptr<const std::vector<float> > > gaussian_kernels;
+	static std::mutex gaussian_kernels_mutex;
+
+	/**
+	 * sigmaのkernelを用意する。キャッシュにないsigmaのテーブルは、ここで計算される。
+	 *
+	 * @param sigma		sigma
+	 */
+	GaussianKernel::GaussianKernel(float sigma) : sigma_(sigma) {
+		std::lock_guard<std::mutex> lock(gaussian_kernels_mutex);
+		auto it = gaussian_kernels.find(sigma);
+		if (it != gaussian_kernels.end()) {
+			table = it->second;
+			return;
+		}
+
+		int radius = (int)ceilf(sigma * 6);
+		std::shared_ptr<std::vector<float> > kernel = std::make_shared<std::vector<float> >(radius + 1);
+		for (int k = 0; k <= radius; ++k) {
+			(*kernel)[k] = gause(k, sigma);
+		}
+		table = kernel;
+
+		if (gaussian_kernels.size() >= MAX_CACHED_KERNELS) gaussian_kernels.clear();
+		gaussian_kernels[sigma] = table;
+	}
+
+	/**
+	 * histogram[i] += weight * gause(u - i, sigma) を、|u - i| <= radius のiについてのみ計算する。
+	 * uが整数ならテーブルを使い、そうでなければgauseを直接計算する。
+	 *
+	 * @param histogram		histogram
+	 * @param u				中心
+	 * @param weight		重み
+	 */
+	void GaussianKernel::splat(std::vector<float>& histogram, float u, float weight) const {
+		const std::vector<float>& kernel = *table;
+		int radius = kernel.size() - 1;
+		if (u + radius < 0 || u - radius > (float)histogram.size() - 1) return;
+
+		int lo = std::max(0, (int)ceilf(u - radius));
+		int hi = std::min((int)histogram.size() - 1, (int)floorf(u + radius));
+		if (u == floorf(u)) {
+			int center = (int)u;
+			for (int i = lo; i <= hi; ++i) {
+				histogram[i] += weight * kernel[std::abs(center - i)];
+			}
+		}
+		else {
+			for (int i = lo; i <= hi; ++i) {
+				histogram[i] += weight * gause(u - i, sigma_);
+			}
+		}
+	}
+
+	/**
+	 * dst[i] = sum_j src[j] * gause(i - j, sigma) を、|i - j| <= radius のjについてのみ計算する。
+	 * srcの外側は足さない。
+	 *
+	 * @param src			入力
+	 * @param dst			[OUT] 出力 (srcと同じ長さ)
+	 */
+	void GaussianKernel::convolve(const std::vector<float>& src, std::vector<float>& dst) const {
+		const std::vector<float>& kernel = *table;
+		int radius = kernel.size() - 1;
+		int n = src.size();
+		dst.assign(n, 0.0f);
+		for (int i = 0; i < n; ++i) {
+			for (int j = std::max(0, i - radius); j <= std::min(n - 1, i + radius); ++j) {
+				dst[i] += src[j] * kernel[std::abs(j - i)];
+			}
+		}
+	}
+
 	float median(std::vector<float> list) {
 		size_t size = list.size();
 		std::sort(list.begin(), list.end());
@@ -18,11 +18,31 @@
 #include "Utils.h"
 #include <time.h>
 #include "FacadeSegmentation.h"
+#include "SymmetryCache.h"
 #include <list>
 #include <boost/filesystem.hpp>
 
 int main() {
 	bool align_windows = false;
+	bool report_symmetry_accuracy = false;
+	bool report_histogram_speed = false;
+	bool compute_symmetry = false;
+	bool report_analysis_stats = false;
+	bool report_tile_skips = false;
+	bool detect_by_tile_types = false;
+	bool skip_blank_tiles = false;
+	bool refine_windows = false;
+	fs::TileStats total_tile_stats;
+
+	// detect the window once per tile type if detect_by_tile_types is true
+	// (the blank tiles are counted by report_tile_skips, but skipped only if skip_blank_tiles is true)
+	fs::WindowOptions window_options;
+	window_options.skip_blank_tiles = skip_blank_tiles;
+	window_options.group_tiles = detect_by_tile_types;
+	window_options.refinement.enabled = refine_windows;
+
+	// Ver/Hor and S_max/h_max are cached by the image and the parameters
+	fs::SymmetryCache cache("../cache/", 256);
 
 	// read the #floors file
 	std::ifstream in("floors_columns.txt");
@@ -42,6 +62,7 @@ int main() {
 
 	boost::filesystem::path dir("../testdata/");
 	//boost::filesystem::path dir("../testdata2/");
+	//boost::filesystem::path dir("../adjusted_testdata/");
 	boost::filesystem::path dir_curve("../curve/");
 	boost::filesystem::path dir_subdiv("../subdivision/");
 	boost::filesystem::path dir_win("../windows/");
@@ -57,8 +78,17 @@ int main() {
 		cv::Mat img = cv::imread(dir.string() + it->path().filename().string());
 
 		// floor height / column width
-		float average_floor_height = (float)img.rows / params[it->path().filename().string()].first;
-		float average_column_width = (float)img.cols / params[it->path().filename().string()].second;
+		// (estimated from the periodicity of Ver and Hor if the file is not listed in floors_columns.txt)
+		float average_floor_height;
+		float average_column_width;
+		if (params.find(it->path().filename().string()) != params.end()) {
+			average_floor_height = (float)img.rows / params[it->path().filename().string()].first;
+			average_column_width = (float)img.cols / params[it->path().filename().string()].second;
+		}
+		else {
+			fs::estimateFloorHeightAndColumnWidth(img, average_floor_height, average_column_width);
+			std::cout << "estimated floor height: " << average_floor_height << ", column width: " << average_column_width << std::endl;
+		}
 
 		// gray scale
 		//cv::Mat gray_img;
@@ -68,56 +98,107 @@ int main() {
 		std::vector<float> x_splits;
 		std::vector<float> y_splits;
 		std::vector<std::vector<fs::WindowPos>> win_rects;
-		fs::subdivideFacade(img, average_floor_height, average_column_width, align_windows, y_splits, x_splits, win_rects);
+		// the intermediates (gray image, blurred image, Ver/Hor, ...) are shared by the subdivision and the visualization
+		fs::FacadeAnalysis analysis(img, average_floor_height, average_column_width);
+		fs::TileStats tile_stats;
+		fs::subdivideFacade(analysis, align_windows, y_splits, x_splits, win_rects, window_options, report_tile_skips ? &tile_stats : NULL);
+		if (report_tile_skips) {
+			std::cout << "skipped tiles: " << tile_stats.num_skipped << " / " << tile_stats.num_tiles << ", false skips: " << tile_stats.num_false_skips << ", detections: " << tile_stats.num_detections << std::endl;
+			total_tile_stats.num_tiles += tile_stats.num_tiles;
+			total_tile_stats.num_skipped += tile_stats.num_skipped;
+			total_tile_stats.num_false_skips += tile_stats.num_false_skips;
+			total_tile_stats.num_detections += tile_stats.num_detections;
+		}
 
 		// grad image
 		{
-			cv::Mat gray_img;
-			cv::cvtColor(img, gray_img, cv::COLOR_BGR2GRAY);
-
-			// compute kernel size
-			int kernel_size_V = average_floor_height / 8;
-			if (kernel_size_V % 2 == 0) kernel_size_V++;
-			int kernel_size_H = average_column_width / 8;
-			if (kernel_size_H % 2 == 0) kernel_size_H++;
-
-			// blur the image according to the average floor height
-			cv::Mat blurred_gray_img;
-			if (kernel_size_V > 1) {
-				cv::GaussianBlur(gray_img, blurred_gray_img, cv::Size(kernel_size_V, kernel_size_V), kernel_size_V);
-			}
-			else {
-				blurred_gray_img = gray_img.clone();
-			}
+			int kernel_size_V = analysis.kernelSizeV();
+			int kernel_size_H = analysis.kernelSizeH();
+			const cv::Mat& blurred_gray_img = analysis.blurredGrayImage();
 
 			cv::Range h_range = cv::Range(average_floor_height * 0.8, average_floor_height * 1.5);
 			cv::Range w_range = cv::Range(average_column_width * 0.6, average_column_width * 1.3);
 
-			// compute Ver and Hor
-			cv::Mat_<float> Ver, Hor;
-			fs::computeVerAndHor2(blurred_gray_img, Ver, Hor, 0.0);
+			// compare the quantized MI with the original 256-bin one
+			if (report_symmetry_accuracy) {
+				int bins[] = { 16, 32, 64 };
+				for (int k = 0; k < 3; ++k) {
+					fs::reportSymmetryAccuracy(blurred_gray_img, h_range, fs::SymmetryOptions(bins[k], false));
+				}
+
+				fs::SymmetryOptions prune_options;
+				prune_options.prune = true;
+				fs::reportSymmetryAccuracy(blurred_gray_img, h_range, prune_options);
 
-			// smooth Ver and Hor
-			if (kernel_size_V > 1) {
-				cv::blur(Ver, Ver, cv::Size(kernel_size_V, kernel_size_V));
+				for (int levels = 2; levels <= 3; ++levels) {
+					fs::SymmetryOptions pyramid_options;
+					pyramid_options.pyramid_levels = levels;
+					fs::reportSymmetryAccuracy(blurred_gray_img, h_range, pyramid_options);
+				}
 			}
-			if (kernel_size_H > 1) {
-				cv::blur(Hor, Hor, cv::Size(kernel_size_H, kernel_size_H));
+			if (report_histogram_speed) {
+				fs::reportJointHistogramSpeed(blurred_gray_img);
 			}
 
-			/*
+			cv::Mat_<float> Ver, Hor;
 			cv::Mat_<float> SV_max;
 			cv::Mat_<int> h_max;
-			fs::computeSV(blurred_gray_img, SV_max, h_max, h_range);
 			cv::Mat_<float> SH_max;
 			cv::Mat_<int> w_max;
-			fs::computeSH(blurred_gray_img, SH_max, w_max, w_range);
-			*/
 
-			//fs::outputFacadeStructure(img, SV_max, Ver, h_max, y_splits, SH_max, Hor, w_max, x_splits, dir_grad.string() + it->path().filename().string(), cv::Scalar(0, 255, 255), 1);
+			// every option that affects the cached values is part of the key (num_threads does not change the results)
+			fs::SymmetryOptions symmetry_options;
+			int cache_params[] = { kernel_size_V, kernel_size_H, h_range.start, h_range.end, w_range.start, w_range.end, compute_symmetry,
+				symmetry_options.bins, symmetry_options.exact, symmetry_options.prune, symmetry_options.pyramid_levels, symmetry_options.top_k };
+			std::string cache_key = fs::SymmetryCache::computeKey(img, std::vector<int>(cache_params, cache_params + sizeof(cache_params) / sizeof(int)));
+
+			// Ver is rows x 1 and Hor is 1 x cols, while SH_max and w_max are cols x 1 since computeSH reuses computeSV on the transposed image
+			std::vector<cv::Size> cached_sizes;
+			cached_sizes.push_back(cv::Size(1, img.rows));
+			cached_sizes.push_back(cv::Size(img.cols, 1));
+			cached_sizes.push_back(cv::Size(1, img.rows));
+			cached_sizes.push_back(cv::Size(1, img.rows));
+			cached_sizes.push_back(cv::Size(1, img.cols));
+			cached_sizes.push_back(cv::Size(1, img.cols));
+			std::vector<cv::Mat> cached_mats;
+			if (cache.load(cache_key, cached_sizes, cached_mats)) {
+				Ver = cached_mats[0];
+				Hor = cached_mats[1];
+				SV_max = cached_mats[2];
+				h_max = cached_mats[3];
+				SH_max = cached_mats[4];
+				w_max = cached_mats[5];
+			}
+			else {
+				// smoothed Ver and Hor (already computed by the subdivision, cloned so that the cached ones are never shared)
+				Ver = analysis.ver().clone();
+				Hor = analysis.hor().clone();
+
+				if (compute_symmetry) {
+					fs::computeSV(blurred_gray_img, SV_max, h_max, h_range, symmetry_options);
+					fs::computeSH(blurred_gray_img, SH_max, w_max, w_range, symmetry_options);
+				}
+
+				cached_mats.clear();
+				cached_mats.push_back(Ver);
+				cached_mats.push_back(Hor);
+				cached_mats.push_back(SV_max);
+				cached_mats.push_back(h_max);
+				cached_mats.push_back(SH_max);
+				cached_mats.push_back(w_max);
+				cache.save(cache_key, cached_mats);
+			}
+
+			if (compute_symmetry) {
+				fs::outputFacadeStructure(img, SV_max, Ver, h_max, y_splits, SH_max, Hor, w_max, x_splits, dir_curve.string() + it->path().filename().string(), cv::Scalar(0, 255, 255), 1);
+			}
 			fs::outputImageWithHorizontalAndVerticalGraph(img, Ver, y_splits, Hor, x_splits, std::string("../grad/") + it->path().filename().string(), 1);
 		}
 
+		if (report_analysis_stats) {
+			analysis.printStats(std::cout);
+		}
+
 		// subdivision image
 		fs::outputFacadeStructure(img, y_splits, x_splits, dir_subdiv.string() + it->path().filename().string(), cv::Scalar(0, 255, 255), 3);
 		
@@ -153,5 +234,13 @@ int main() {
 	}
 	tile_out.close();
 
+	if (report_tile_skips && total_tile_stats.num_tiles > 0) {
+		std::cout << "skip rate: " << (float)total_tile_stats.num_skipped / total_tile_stats.num_tiles << std::endl;
+		if (total_tile_stats.num_skipped > 0) {
+			std::cout << "false skip rate: " << (float)total_tile_stats.num_false_skips / total_tile_stats.num_skipped << std::endl;
+		}
+		std::cout << "detections per tile: " << (float)total_tile_stats.num_detections / total_tile_stats.num_tiles << std::endl;
+	}
+
 	return 0;
 }